@@ -13,6 +13,7 @@
 #include "storage.h"
 #include "configtool.h"
 #include "upgrade.h"
+#include "modbus.h"
 #include "oled.h"
 #include "bmp.h"
 #include "display.h"
@@ -92,7 +93,7 @@ int main()
 	
 	OLED_Init();
 	OLED_ShowPicture(32, 0, 64, 64, (uint8_t *)smail_64x64_1, 1);
-	OLED_Refresh();
+	OLED_Flush();
 	
 	display_init();
 	cfg_init();
@@ -119,8 +120,13 @@ int main()
 	LOG_INFO(TAG, "main loop start ...");
 	
     while(1){
-		OLED_Refresh();
+		display_poll();
 		upgrade_run();
+		// compact storage in idle time, never while a frame is coming in or 
+		// a response is going out
+		if (!modbus_is_receiving() && !modbus_is_sending()){
+			st_poll();
+		}
 //		if (worktime_since(worktime) >= 1000){
 //			worktime = worktime_get();
 //			if ((worktime / 1000) % 2){
@@ -11,6 +11,8 @@ typedef struct cfg_cache_s{
 	uint8_t mb_addr;
 	cfg_uart_t mb_uart;
 	cfg_ota_t ota;
+	cfg_boot_t boot;
+	cfg_copy_t copy;
 } cfg_cache_t;
 
 static cfg_cache_t cfg_cache = {0};
@@ -28,6 +30,8 @@ typedef enum cfg_idx{
 	CFG_IDX_MB_ADDR,
 	CFG_IDX_MB_UART,
 	CFG_IDX_OTA,
+	CFG_IDX_BOOT,
+	CFG_IDX_COPY,
 	CFG_IDX_MAX,
 } cfg_idx_t;
 #define CFG_IDX_VALID(i)	((i) > CFG_IDX_BASE && (i) < CFG_IDX_MAX)
@@ -35,17 +39,14 @@ static struct cfg_item cfg_items[] = {
 	{CFG_KEY_MB_ADDR, &cfg_cache.mb_addr, sizeof(cfg_cache.mb_addr), NULL, NULL},
 	{CFG_KEY_MB_UART, &cfg_cache.mb_uart, sizeof(cfg_cache.mb_uart), NULL, NULL},
 	{CFG_KEY_OTA, &cfg_cache.ota, sizeof(cfg_cache.ota), NULL, NULL},
+	{CFG_KEY_BOOT, &cfg_cache.boot, sizeof(cfg_cache.boot), NULL, NULL},
+	{CFG_KEY_COPY, &cfg_cache.copy, sizeof(cfg_cache.copy), NULL, NULL},
 };
 
-static int cfg_save_item(cfg_idx_t idx, void *content, int len){
+static int cfg_encode_item(struct cfg_item *item, void *content, int len, 
+	uint8_t *buf)
+{
 	int ret = 0;
-	//int buflen;
-	if (!CFG_IDX_VALID(idx)){
-		return -1;
-	}
-	struct cfg_item *item = &cfg_items[idx];
-	uint8_t buf[2 * item->size];
-	
 	if (item->encode_func){
 		ret = item->encode_func(content, len, buf);
 		if (ret < 0){
@@ -56,6 +57,23 @@ static int cfg_save_item(cfg_idx_t idx, void *content, int len){
 		memset(buf, 0, item->size);
 		memcpy(buf, content, MIN(item->size, len));
 	}
+	return 0;
+}
+
+static int cfg_save_item(cfg_idx_t idx, void *content, int len){
+	int ret = 0;
+	//int buflen;
+	if (!CFG_IDX_VALID(idx)){
+		return -1;
+	}
+	//cfg_idx_t starts from 1 while cfg_items starts from 0
+	struct cfg_item *item = &cfg_items[idx - CFG_IDX_MB_ADDR];
+	uint8_t buf[2 * item->size];
+	
+	ret = cfg_encode_item(item, content, len, buf);
+	if (ret < 0){
+		return -1;
+	}
 	ret = st_write_item(item->key, buf, item->size);
 	if (ret < 0){
 		LOG_ERROR(TAG, "fail to save %04X.", item->key);
@@ -66,6 +84,42 @@ fail:
 	return -1;
 }
 
+/**
+ * @brief save several items in one storage transaction, either all or none of 
+ * them are updated.
+ */
+static int cfg_save_items(cfg_idx_t *idx, void **content, int cnt){
+	st_batch_item_t items[CFG_IDX_MAX];
+	uint8_t buf[2 * sizeof(cfg_cache_t)];
+	struct cfg_item *item = NULL;
+	int used = 0;
+	int ret = 0;
+	int i = 0;
+	if (cnt <= 0 || cnt >= CFG_IDX_MAX){
+		return -1;
+	}
+	for (i = 0; i < cnt; i++){
+		if (!CFG_IDX_VALID(idx[i])){
+			return -1;
+		}
+		item = &cfg_items[idx[i] - CFG_IDX_MB_ADDR];
+		ret = cfg_encode_item(item, content[i], item->size, buf + used);
+		if (ret < 0){
+			return -1;
+		}
+		items[i].item_idx = item->key;
+		items[i].buf = buf + used;
+		items[i].len = item->size;
+		used += 2 * item->size;
+	}
+	ret = st_write_batch(items, cnt);
+	if (ret < 0){
+		LOG_ERROR(TAG, "fail to save %d items.", cnt);
+		return -1;
+	}
+	return 0;
+}
+
 int cfg_get_mb_uart(cfg_uart_t *result){
 	int ret = 0;
 	if (!result){
@@ -113,6 +167,48 @@ int cfg_update_ota(cfg_ota_t *val){
 	}
 	return 0;
 }
+int cfg_get_boot(cfg_boot_t *result){
+	if (!result){
+		return -1;
+	}
+	memcpy(result, &cfg_cache.boot, sizeof(cfg_boot_t));
+	return 0;
+}
+
+int cfg_update_boot(cfg_boot_t *val){
+	if (!val){
+		return -1;
+	}
+	if (memcmp(&cfg_cache.boot, val, sizeof(cfg_boot_t))){
+		int ret = cfg_save_item(CFG_IDX_BOOT, val, sizeof(cfg_boot_t));
+		if (ret < 0){
+			return -1;
+		}
+		memcpy(&cfg_cache.boot, val, sizeof(cfg_boot_t));
+	}
+	return 0;
+}
+int cfg_get_copy(cfg_copy_t *result){
+	if (!result){
+		return -1;
+	}
+	memcpy(result, &cfg_cache.copy, sizeof(cfg_copy_t));
+	return 0;
+}
+
+int cfg_update_copy(cfg_copy_t *val){
+	if (!val){
+		return -1;
+	}
+	if (memcmp(&cfg_cache.copy, val, sizeof(cfg_copy_t))){
+		int ret = cfg_save_item(CFG_IDX_COPY, val, sizeof(cfg_copy_t));
+		if (ret < 0){
+			return -1;
+		}
+		memcpy(&cfg_cache.copy, val, sizeof(cfg_copy_t));
+	}
+	return 0;
+}
 int cfg_get_mb_addr(uint8_t *result){
 	int ret = 0;
 	if (!result){
@@ -137,16 +233,106 @@ int cfg_update_mb_addr(uint8_t val){
 	return 0;
 }
 
-static int cfg_load_default(){
-	memset(&cfg_cache, 0, sizeof(cfg_cache));
-	cfg_cache.mb_addr = 1;
-	cfg_cache.mb_uart.baudrate = 9600;
-	cfg_cache.mb_uart.databits = 8;
-	cfg_cache.mb_uart.parity = CFG_UART_PAR_NONE;
-	cfg_cache.mb_uart.stopbits = CFG_UART_SB_1;
+/**
+ * @brief update several config items at once, NULL means unchanged. Changed 
+ * items are saved in one storage transaction.
+ */
+int cfg_update(uint8_t *mb_addr, cfg_uart_t *mb_uart, cfg_ota_t *ota, 
+	cfg_boot_t *boot, cfg_copy_t *copy)
+{
+	void *val[CFG_IDX_MAX] = {NULL, mb_addr, mb_uart, ota, boot, copy};
+	cfg_idx_t idx[CFG_IDX_MAX];
+	void *content[CFG_IDX_MAX];
+	struct cfg_item *item = NULL;
+	int cnt = 0;
+	int ret = 0;
+	int i = 0;
+	if (mb_addr && !*mb_addr){
+		return -1;
+	}
+	for (i = CFG_IDX_MB_ADDR; i < CFG_IDX_MAX; i++){
+		item = &cfg_items[i - CFG_IDX_MB_ADDR];
+		if (val[i] && memcmp(item->content, val[i], item->size)){
+			idx[cnt] = i;
+			content[cnt++] = val[i];
+		}
+	}
+	if (!cnt){
+		return 0;
+	}
+	ret = cfg_save_items(idx, content, cnt);
+	if (ret < 0){
+		return -1;
+	}
+	for (i = 0; i < cnt; i++){
+		item = &cfg_items[idx[i] - CFG_IDX_MB_ADDR];
+		memcpy(item->content, content[i], item->size);
+	}
+	return 0;
+}
+
+static int cfg_load_default(cfg_cache_t *cache){
+	memset(cache, 0, sizeof(cfg_cache_t));
+	cache->mb_addr = 1;
+	cache->mb_uart.baudrate = 9600;
+	cache->mb_uart.databits = 8;
+	cache->mb_uart.parity = CFG_UART_PAR_NONE;
+	cache->mb_uart.stopbits = CFG_UART_SB_1;
 	return 0;
 }
 
+static int cfg_is_zero(const uint8_t *buf, int len){
+	while (len-- > 0){
+		if (*buf++){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief Builds before the cfg_items index fix saved each item under the key 
+ * of the next one, zero padded to the size of that item: the address under 
+ * CFG_KEY_MB_UART and the UART config under CFG_KEY_OTA. Their OTA config 
+ * went to no valid key and is lost. Such records are recognized by the 
+ * padding, moved into the right items and replaced by the defaults.
+ * @return mask(1 << cfg_idx_t) of the items to save again
+ */
+static int cfg_migrate(){
+	cfg_cache_t def;
+	cfg_uart_t uart;
+	uint8_t *buf = NULL;
+	int moved = 0;
+	cfg_load_default(&def);
+	// a real UART record has a baudrate above 255, so not only byte 0 is set
+	buf = (uint8_t *)&cfg_cache.mb_uart;
+	if (buf[0] && buf[0] <= 247 && 
+		cfg_is_zero(buf + 1, sizeof(cfg_uart_t) - 1))
+	{
+		LOG_INFO(TAG, "move address saved under %04X.", CFG_KEY_MB_UART);
+		cfg_cache.mb_addr = buf[0];
+		memcpy(&cfg_cache.mb_uart, &def.mb_uart, sizeof(cfg_uart_t));
+		moved |= (1 << CFG_IDX_MB_ADDR) | (1 << CFG_IDX_MB_UART);
+	}
+	// a real OTA record never has a zero md5 next to a version
+	buf = (uint8_t *)&cfg_cache.ota;
+	memcpy(&uart, buf, sizeof(cfg_uart_t));
+	if (uart.baudrate > 0xFF && uart.databits >= 5 && uart.databits <= 8 && 
+		CFG_UART_PAR_VALID(uart.parity) && CFG_UART_SB_VALID(uart.stopbits) && 
+		cfg_is_zero(buf + sizeof(cfg_uart_t), 
+			sizeof(cfg_ota_t) - sizeof(cfg_uart_t)))
+	{
+		LOG_INFO(TAG, "move uart config saved under %04X.", CFG_KEY_OTA);
+		memcpy(&cfg_cache.mb_uart, &uart, sizeof(cfg_uart_t));
+		memcpy(&cfg_cache.ota, &def.ota, sizeof(cfg_ota_t));
+		moved |= (1 << CFG_IDX_MB_UART) | (1 << CFG_IDX_OTA);
+	}
+	return moved;
+}
+
+/**
+ * @return (-1)-error, 0-item loaded, 1-item not found, default value is kept
+ */
 static int cfg_item_init(cfg_item_t *item){
 	if (!item){
 		return -1;
@@ -155,22 +341,22 @@ static int cfg_item_init(cfg_item_t *item){
 	if (ret <= 0){
 		if (0 == ret){
 			LOG_INFO(TAG, "%04X not found. write new one.", item->key);
-			ret = st_write_item(item->key, item->content, item->size);
-			if (ret < 0){
-				LOG_ERROR(TAG, "fail to save %s.", item->key);
-				return -1;
-			}
-		}else{
-			LOG_ERROR(TAG, "fail to get %04X", item->key);
-			return -1;
+			return 1;
 		}
+		LOG_ERROR(TAG, "fail to get %04X", item->key);
+		return -1;
 	}
 	if (item->decode_func){
 		item->decode_func(item);
 	}
+	return 0;
 }
 
 int cfg_init(){
+	cfg_idx_t idx[CFG_IDX_MAX];
+	void *content[CFG_IDX_MAX];
+	int save = 0;
+	int cnt = 0;
 	int ret = 0;
 	int i = 0;
 	if (cfg_flag_init){
@@ -180,9 +366,22 @@ int cfg_init(){
 	if (ret < 0){
 		return -1;
 	}
-	cfg_load_default();
+	cfg_load_default(&cfg_cache);
 	for(i = 0; i < ARRAY_SIZE(cfg_items); i++){
-		cfg_item_init(&cfg_items[i]);
+		if (cfg_item_init(&cfg_items[i]) > 0){
+			save |= 1 << (CFG_IDX_MB_ADDR + i);
+		}
+	}
+	save |= cfg_migrate();
+	for (i = CFG_IDX_MB_ADDR; i < CFG_IDX_MAX; i++){
+		if (save & (1 << i)){
+			idx[cnt] = i;
+			content[cnt++] = cfg_items[i - CFG_IDX_MB_ADDR].content;
+		}
+	}
+	// write all missing and moved items in one go
+	if (cnt && cfg_save_items(idx, content, cnt) < 0){
+		LOG_ERROR(TAG, "fail to save default config.");
 	}
 	cfg_flag_init = 1;
 	return 0;
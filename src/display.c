@@ -1,9 +1,12 @@
+
 #include <stdio.h>
 #include <string.h>
 
 #include <stdarg.h>
 
 #include "display.h"
+#include "worktime.h"
+#include "utils.h"
 
 typedef struct display_line_s {
 	uint8_t len;
@@ -14,32 +17,37 @@ static display_line_t lines[DISPLAY_LINE_MAX];
 
 static display_line_t *line_idx[DISPLAY_LINE_MAX] = {0};
 
+#define DISPLAY_LINE_PAGES	(DISPLAY_FONT_SIZE / 8)
+
+//characters of each line currently drawn in GRAM, ' ' for blank cells
+static uint8_t line_shown[DISPLAY_LINE_MAX][DISPLAY_LINE_LEN];
+//bit i: line i changed since the last frame
+static uint8_t line_pending = 0;
+//lines scrolled since the last frame, GRAM is moved on the next frame
+static uint8_t scroll_pending = 0;
+static worktime_t frame_time = 0;
 
 int display_init(){
 	int i = 0;
 	for(i = 0; i < DISPLAY_LINE_MAX; i++){
 		line_idx[i] = &lines[i];
 	}
+	memset(line_shown, ' ', sizeof(line_shown));
 	return 0;
 }
 
 static int display_scroll(){
 	int i = 0;
 	display_line_t *tmp = line_idx[0];
-	oled_area_t area = {0};
-	area.height = DISPLAY_FONT_SIZE;
-	area.width = tmp->len * DISPLAY_FONT_WIDTH;
-
-	for (i = 0; i < DISPLAY_LINE_MAX; i++){
-		area.y = i * DISPLAY_FONT_SIZE;
-		area.width = line_idx[i]->len * DISPLAY_FONT_WIDTH;
-		OLED_clear_buffer(&area);
-	}
 	for (i = 0; i < DISPLAY_LINE_MAX - 1; i++){
 		line_idx[i] = line_idx[i + 1];
 	}
 	tmp->len = 0;
 	line_idx[i] = tmp;
+	line_pending >>= 1;
+	if (scroll_pending < DISPLAY_LINE_MAX){
+		scroll_pending ++;
+	}
 	return 0;
 }
 
@@ -54,44 +62,82 @@ static int get_empty_line(){
 	return DISPLAY_LINE_MAX - 1;
 }
 
-static int display_refresh(){
+/**
+ * @brief Apply the scrolls since the last frame: move the kept lines up in
+ * GRAM by whole pages, then redraw the lines scrolled in from the bottom.
+ */
+static void display_move(){
+	uint8_t n = scroll_pending;
+	if (!n){
+		return;
+	}
+	if (n < DISPLAY_LINE_MAX){
+		OLED_MovePages(0, n * DISPLAY_LINE_PAGES,
+			(DISPLAY_LINE_MAX - n) * DISPLAY_LINE_PAGES);
+		memmove(line_shown[0], line_shown[n],
+			(DISPLAY_LINE_MAX - n) * DISPLAY_LINE_LEN);
+	}
+	line_pending |= ((1 << n) - 1) << (DISPLAY_LINE_MAX - n);
+	scroll_pending = 0;
+}
+
+/**
+ * @brief Draw the characters of a line that differ from what GRAM shows.
+ */
+static void display_render(int line){
+	display_line_t *l = line_idx[line];
+	uint8_t *shown = line_shown[line];
+	uint8_t chr = 0;
 	int i = 0;
-	for (i = 0; i < DISPLAY_LINE_MAX; i++){
-		if (!line_idx[i]->len){
-			continue;
+	for (i = 0; i < DISPLAY_LINE_LEN; i++){
+		chr = i < l->len ? l->buffer[i] : ' ';
+		if (shown[i] != chr){
+			OLED_ShowCharPage(i * DISPLAY_FONT_WIDTH, line * DISPLAY_LINE_PAGES,
+				chr, DISPLAY_FONT_SIZE);
+			shown[i] = chr;
 		}
-		OLED_ShowString(0, i * DISPLAY_FONT_SIZE, line_idx[i]->buffer, 
-			DISPLAY_FONT_SIZE, 1);
+	}
+}
+
+/**
+ * @brief Draw the lines changed since the last frame, at most once every
+ * DISPLAY_FRAME_MS, and push GRAM to the panel. Called from the main loop.
+ */
+void display_poll(){
+	int i = 0;
+	if ((line_pending || scroll_pending) &&
+		worktime_since(frame_time) >= DISPLAY_FRAME_MS)
+	{
+		display_move();
+		for (i = 0; i < DISPLAY_LINE_MAX; i++){
+			if (line_pending & (1 << i)){
+				display_render(i);
+			}
+		}
+		line_pending = 0;
+		frame_time = worktime_get();
 	}
 	OLED_Refresh();
-	return 0;
 }
 
+/**
+ * @brief Set the text of a line. It's drawn by display_poll, writes to the
+ * same line in between only keep the last text.
+ */
 int display_string(int line, char *str){
 	int len = 0;
 	if (!str){
 		return 0;
 	}
-	len = strlen(str);
-	if (line < 0 || line > DISPLAY_LINE_MAX){
+	if (line < 0 || line >= DISPLAY_LINE_MAX){
 		line = get_empty_line();
-	}else{
-		if (len < line_idx[line]->len){
-			oled_area_t area = {
-				.x = len * DISPLAY_FONT_WIDTH,
-				.y = line * DISPLAY_FONT_SIZE,
-				.height = DISPLAY_FONT_SIZE,
-				.width = (line_idx[line]->len - len) * DISPLAY_FONT_WIDTH,
-			};
-			OLED_clear_buffer(&area);
-		}
 	}
 	len = snprintf(line_idx[line]->buffer, DISPLAY_LINE_LEN, "%s", str);
 	if (len < 0){
 		return -1;
 	}
-	line_idx[line]->len = len;
-	display_refresh();
+	line_idx[line]->len = MIN(len, DISPLAY_LINE_LEN - 1);
+	line_pending |= 1 << line;
 	return 0;
 }
 
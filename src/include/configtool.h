@@ -12,10 +12,32 @@ typedef struct cfg_ota_s{
 	uint8_t ota_md5[16];
 }cfg_ota_t;
 
+/**
+ * Boot verification record. A key is derived from version, size and md5 of 
+ * an image once its md5 has been checked, 0 means not verified.
+ */
+typedef struct cfg_boot_s{
+	uint16_t app_key;
+	uint16_t ota_key;
+	uint16_t boot_cnt;	//boots since the last full check
+}cfg_boot_t;
+
+/**
+ * Journal of copying the backup image to the app part, ota_key 0 means 
+ * no copy is in progress.
+ */
+typedef struct cfg_copy_s{
+	uint32_t ota_size;
+	uint32_t bytes_copied;	//app part is complete up to here
+	uint16_t ota_key;	//key of the image being copied, as in cfg_boot_t
+}cfg_copy_t;
+
 typedef enum cfg_key{
 	CFG_KEY_MB_ADDR = 1,
 	CFG_KEY_MB_UART,
 	CFG_KEY_OTA,
+	CFG_KEY_BOOT,
+	CFG_KEY_COPY,
 	CFG_KEY_MAX,
 } cfg_key_t;
 
@@ -58,9 +80,15 @@ typedef struct cfg_uart{
 int cfg_init();
 int cfg_get_ota(cfg_ota_t *result);
 int cfg_update_ota(cfg_ota_t *val);
+int cfg_get_boot(cfg_boot_t *result);
+int cfg_update_boot(cfg_boot_t *val);
+int cfg_get_copy(cfg_copy_t *result);
+int cfg_update_copy(cfg_copy_t *val);
 int cfg_get_mb_addr(uint8_t *result);
 int cfg_update_mb_addr(uint8_t val);
 int cfg_get_mb_uart(cfg_uart_t *result);
 int cfg_update_mb_uart(cfg_uart_t *val);
+int cfg_update(uint8_t *mb_addr, cfg_uart_t *mb_uart, cfg_ota_t *ota, 
+	cfg_boot_t *boot, cfg_copy_t *copy);
 
 #endif
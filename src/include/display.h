@@ -9,12 +9,16 @@
 #define DISPLAY_LINE_MAX	(OLED_Y_MAX / DISPLAY_FONT_SIZE)
 #define DISPLAY_LINE_LEN	(OLED_X_MAX / DISPLAY_FONT_WIDTH)
 
+//minimum interval between two frames, in ms
+#define DISPLAY_FRAME_MS	50
+
 #define DISPLAY_LAST_LINE	(DISPLAY_LINE_MAX - 1)
 #define DISPLAY_ANY_LINE	-1
 
 #define DISPLAY_PRINT(fmt, ...)	display_printline(DISPLAY_ANY_LINE, fmt, ##__VA_ARGS__)
 
 int display_init();
+void display_poll();
 int display_string(int line, char *str);
 int display_printline(int line, char *fmt, ...);
 
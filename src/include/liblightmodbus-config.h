@@ -17,5 +17,7 @@
 //#define LIGHTMODBUS_MASTER_OMIT_REQUEST_CRC	//Omits request CRC calculation for request on master side
 //#define LIGHTMODBUS_WARN_UNUSED	//Compiler attribute to warn about unused return value. __attribute__((warn_unused_result)) by default
 //#define LIGHTMODBUS_ALWAYS_INLINE //Compiler attribute to always inline a function. __attribute__((always_inline)) by default
+#define LIGHTMODBUS_CRC_TABLE	//Modbus CRC with a 512-byte table
+//#define LIGHTMODBUS_CRC_SLICE4	//Modbus CRC four bytes at a time, 2KB of tables
 
 #endif
@@ -29,6 +29,25 @@ typedef struct mb_callback{
 	mb_coil_callback_t after_coil_write;
 } mb_callback_t;
 
+/**
+ * UART2 RX FIFO trigger level(1, 2, 4 or 7). Above 1, received bytes are 
+ * taken in batches and the end of a frame is detected by the UART receive 
+ * timeout, TMR0 then only runs for what is left of T3.5.
+ */
+#ifndef MODBUS_RX_TRIG_BYTES
+#define MODBUS_RX_TRIG_BYTES	4
+#endif
+/**
+ * Idle chars on the line before UART_II_RECV_TOUT fires
+ */
+#define MODBUS_RX_TOUT_CHARS	4
+
+/**
+ * Function handlers of the slave, the lightmodbus defaults plus the ones 
+ * added by modbus_add_function
+ */
+#define MODBUS_FUNC_MAX	16
+
 typedef enum modbus_status {
 	MODBUS_S_INIT = 0,
 	MODBUS_S_IDLE,
@@ -42,18 +61,25 @@ typedef struct modbus_slave_context{
 	uint8_t address;
 	uint32_t baudrate;
 	uint32_t tcnt;
+	uint32_t rx_tout_ticks;	//timer ticks already passed when RECV_TOUT fires
 	uint8_t flag_frame_err;
 	modbus_status_t status;
 	mb_callback_t callback;
 	int req_len;
+	uint16_t req_crc;	//CRC of req_buf so far, 0 once a valid frame is in
 	uint8_t req_buf[256];
 	uint8_t resp_buf[256];
+	const uint8_t *tx_buf;	//response being sent from the THR empty interrupt
+	volatile uint16_t tx_len;	//0 when idle
+	volatile uint16_t tx_pos;
 	uint32_t lasttime_recv;
 } mb_slave_ctx_t;
 
 int modbus_is_receiving();
+int modbus_is_sending();
 void modbus_init(mb_callback_t *callback);
 void modbus_deinit();
 void modbus_frame_check();
+int modbus_add_function(uint8_t id, ModbusRequestParsingFunction handler);
 
 #endif
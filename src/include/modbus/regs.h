@@ -9,6 +9,11 @@
 #define MB_REG_APP_STATE_APP	2
 
 #define MB_REG_DATA_BUF_SIZE	4096
+#define MB_REG_DATA_BUF_NUM	2
+
+/* MB_REG_ADDR_BUF_STATE, two bits per data buffer */
+#define MB_REG_BUF_S_BUSY(n)	(0x01U << ((n) * 2))	//queued or being flashed
+#define MB_REG_BUF_S_ERR(n)	(0x02U << ((n) * 2))	//last flash of it failed
 
 typedef enum mb_reg_addr{
 	MB_REG_ADDR_RO_BASE = 0,
@@ -37,6 +42,7 @@ typedef enum mb_reg_addr{
 	MB_REG_ADDR_OPT_STATE,
 	MB_REG_ADDR_OPT_PROGRESS,
 	MB_REG_ADDR_OPT_ERR,
+	MB_REG_ADDR_BUF_STATE,
 	MB_REG_ADDR_RO_MAX,
 	
 	MB_REG_ADDR_CONFIG_BASE = 128,
@@ -46,6 +52,11 @@ typedef enum mb_reg_addr{
 	MB_REG_ADDR_DATA_CRC,
 	MB_REG_ADDR_BUF_START,
 	MB_REG_ADDR_BUF_MAX = MB_REG_ADDR_BUF_START + (MB_REG_DATA_BUF_SIZE/2),
+	MB_REG_ADDR_DATA_B_LEN_H = MB_REG_ADDR_BUF_MAX,
+	MB_REG_ADDR_DATA_B_LEN_L,
+	MB_REG_ADDR_DATA_B_CRC,
+	MB_REG_ADDR_BUF_B_START,
+	MB_REG_ADDR_BUF_B_MAX = MB_REG_ADDR_BUF_B_START + (MB_REG_DATA_BUF_SIZE/2),
 	MB_REG_ADDR_CONFIG_MAX,
 	
 	MB_REG_ADDR_MAX
@@ -58,6 +69,7 @@ void modbus_reg_update_uid(const uint8_t *uid, uint16_t len);
 ModbusError modbus_reg_callback(void *ctx, 
 	const ModbusRegisterCallbackArgs *args,
 	ModbusRegisterCallbackResult *out);
+void modbus_regs_attach(ModbusSlave *slave);
 const uint8_t *modbus_reg_buf_addr(mb_reg_addr_t addr);
 
 #endif
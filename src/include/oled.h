@@ -6,11 +6,23 @@
 
 #define OLED_X_MAX	128
 #define OLED_Y_MAX	64
+#define OLED_PAGE_MAX	(OLED_Y_MAX / 8)
 
 #define OLED_X_VALID(x)	((x) >= 0 && (x) < OLED_X_MAX)
 #define OLED_Y_VALID(y)	((y) >= 0 && (y) < OLED_Y_MAX)
 
+//OLED传输方式：0-GPIO模拟SPI，1-硬件SPI0+DMA，SCL/SDA需接SCK0/MOSI(PA13/PA14)
+#ifndef OLED_USE_SPI0
+#define OLED_USE_SPI0	0
+#endif
+//SPI0时钟分频，SSD1306时钟不超过10MHz
+#define OLED_SPI0_CLK_DIV	8
+
 //-----------------OLED端口定义---------------- 
+#if OLED_USE_SPI0
+#define OLED_SCL_INIT()	{GPIOA_ModeCfg(GPIO_Pin_13, GPIO_ModeOut_PP_20mA);}
+#define OLED_SDA_INIT()	{GPIOA_ModeCfg(GPIO_Pin_14, GPIO_ModeOut_PP_20mA);}
+#else
 #define OLED_SCL_INIT()	{GPIOB_ModeCfg(GPIO_Pin_0, GPIO_ModeOut_PP_20mA);}
 #define OLED_SCL_Clr() GPIOB_ResetBits(GPIO_Pin_0)//SCL
 #define OLED_SCL_Set() GPIOB_SetBits(GPIO_Pin_0)
@@ -21,6 +33,7 @@
 }
 #define OLED_SDA_Clr() GPIOB_ResetBits(GPIO_Pin_1)//SDA
 #define OLED_SDA_Set() GPIOB_SetBits(GPIO_Pin_1)
+#endif
 
 #define OLED_RES_INIT()	{\
 	GPIOB_ModeCfg(GPIO_Pin_2, GPIO_ModeOut_PP_20mA);\
@@ -60,11 +73,15 @@ void OLED_WR_Byte(uint8_t dat,uint8_t mode);
 void OLED_DisPlay_On(void);
 void OLED_DisPlay_Off(void);
 void OLED_Refresh(void);
+void OLED_Flush(void);
 void OLED_Clear(void);
 void OLED_DrawPoint(uint8_t x,uint8_t y,uint8_t t);
+void OLED_BlitPage(uint8_t page, uint8_t x, const uint8_t *data, uint8_t len);
+void OLED_MovePages(uint8_t dst, uint8_t src, uint8_t n);
 void OLED_DrawLine(uint8_t x1,uint8_t y1,uint8_t x2,uint8_t y2,uint8_t mode);
 void OLED_DrawCircle(uint8_t x,uint8_t y,uint8_t r);
 void OLED_ShowChar(uint8_t x,uint8_t y,uint8_t chr,uint8_t size1,uint8_t mode);
+void OLED_ShowCharPage(uint8_t x, uint8_t page, uint8_t chr, uint8_t size1);
 void OLED_ShowChar6x8(uint8_t x,uint8_t y,uint8_t chr,uint8_t mode);
 void OLED_ShowString(uint8_t x,uint8_t y,uint8_t *chr,uint8_t size1,uint8_t mode);
 void OLED_ShowNum(uint8_t x,uint8_t y,uint32_t num,uint8_t len,uint8_t size1,uint8_t mode);
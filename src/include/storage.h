@@ -4,8 +4,15 @@
 #include "CH58x_common.h"
 
 #define ST_PAGE_SIZE EEPROM_PAGE_SIZE
-//#define ST_PAGE_MAX	(EEPROM_MAX_SIZE/EEPROM_PAGE_SIZE)
+/**
+ * Pages used by the storage log, the first 1KB of Data-Flash by default, the 
+ * rest is left to the app. Build with -DST_PAGE_MAX=n to spread the log over 
+ * more pages(up to EEPROM_MAX_SIZE/EEPROM_PAGE_SIZE) for wear leveling, the 
+ * whole span must then be reserved for it.
+ */
+#ifndef ST_PAGE_MAX
 #define ST_PAGE_MAX	4
+#endif
 
 #define ST_PAGE_VALID(p)	((p) >= 0 && (p) < ST_PAGE_MAX)
 
@@ -13,7 +20,25 @@
 
 #define ST_MAX_CONTENT_LEN	(EEPROM_PAGE_SIZE - 8)
 #define ST_ITEM_IDX_MAX	0xffff
-#define ST_ITEM_IDX_VALID(i)	((i) > 0 && (i) < ST_ITEM_IDX_MAX)
+
+/**
+ * Number of items kept in the in-RAM index. Items beyond this limit are still 
+ * stored, but looking them up falls back to scanning the pages.
+ */
+#ifndef ST_INDEX_MAX
+#define ST_INDEX_MAX	32
+#endif
+
+/**
+ * Reserved idx of the record written in front of the items of a batch.
+ */
+#define ST_ITEM_IDX_BATCH	(ST_ITEM_IDX_MAX - 1)
+/**
+ * Max number of items written by one st_write_batch call
+ */
+#define ST_BATCH_ITEM_MAX	8
+
+#define ST_ITEM_IDX_VALID(i)	((i) > 0 && (i) < ST_ITEM_IDX_BATCH)
 typedef struct st_item_header{
 	uint8_t len;
 	uint8_t crc;
@@ -26,35 +51,79 @@ typedef struct st_item{
 } st_item_t;
 
 /**
- * The page is empty(all bytes are 0xff), Page is not used to store any data 
- * at this point.
+ * The page is empty(all bytes but the erase counter are 0xff), Page is not 
+ * used to store any data at this point.
+ * Other status values never match those of the old layout with a 1 byte 
+ * page header, see ST_PAGE_S_OLD_ACTIVE.
  */
 #define ST_PAGE_S_ERASED	0xFF
 /**
  * Page is active, data can wirte here. No more than one page can be in this 
- * state at any given moment.
+ * state at any given moment, except while switching to the next page.
  */
-#define ST_PAGE_S_ACTIVE		0xFE
+#define ST_PAGE_S_ACTIVE		0xFA
 
 /**
  *	The page is filled with key-value pairs, Writing new key-value pairs into 
  *	this page is not possible. It is still possible to mark some key-value 
  *	pairs as erased.
  */
-#define ST_PAGE_S_FULL		0xFC
+#define ST_PAGE_S_FULL		0xF2
 
 /**
  * Non-erased key-value pairs are being moved into another page so that the 
  * current page can be erased. 
  */
-#define ST_PAGE_S_ERASEING	0xF8
+#define ST_PAGE_S_ERASEING	0xE2
 
 /**
  * Page is full, and all data was marked as erased 
  */
 #define ST_PAGE_S_UNAVAILABLE	0x00
 
-#define ST_PAGE_HEADER_SIZE	sizeof(uint8_t)
+/**
+ * Status of pages written by the old layout, which had a 1 byte page header 
+ * and no erase counter(ERASEING 0xF8 was never written). st_init moves their 
+ * live items into the log and erases them.
+ */
+#define ST_PAGE_S_OLD_ACTIVE	0xFE
+#define ST_PAGE_S_OLD_FULL	0xFC
+#define ST_OLD_HEADER_SIZE	1
+
+/**
+ * Page header. "erase_cnt"(little endian) is programmed right after the page 
+ * is erased, it reads ST_ERASE_CNT_UNKNOWN if that was interrupted.
+ */
+typedef struct st_page_header{
+	uint8_t status;
+	uint8_t erase_cnt[3];
+} st_page_header_t;
+#define ST_ERASE_CNT_UNKNOWN	0xFFFFFF
+
+/**
+ * Garbage collection prefers pages with more reclaimable bytes and less wear. 
+ * Once the erase counts of the pages differ by more than ST_WEAR_DELTA_MAX, 
+ * the least worn page is collected instead, so that pages holding cold data 
+ * take their share of erases.
+ */
+#ifndef ST_WEAR_DELTA_MAX
+#define ST_WEAR_DELTA_MAX	32
+#endif
+#define ST_WEAR_WEIGHT	16
+
+/**
+ * Pages are compacted incrementally, at most ST_GC_STEP_ITEMS items are moved 
+ * by a st_poll call or a write. Compaction starts once no more than 
+ * ST_GC_PAGE_LOW pages are erased.
+ */
+#ifndef ST_GC_STEP_ITEMS
+#define ST_GC_STEP_ITEMS	2
+#endif
+#ifndef ST_GC_PAGE_LOW
+#define ST_GC_PAGE_LOW	(ST_PAGE_MAX < 32 ? 2 : 8)
+#endif
+
+#define ST_PAGE_HEADER_SIZE	sizeof(st_page_header_t)
 #define ST_PAGE_CONTENT_MAX	(ST_PAGE_SIZE - ST_PAGE_HEADER_SIZE)
 
 //#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
@@ -76,16 +145,26 @@ typedef struct st_item{
 
 typedef uint8_t st_page_status_t;
 
+typedef struct st_batch_item{
+	uint16_t item_idx;
+	uint8_t *buf;
+	int len;
+} st_batch_item_t;
+
 typedef struct st_page{
 	uint8_t status;
 	uint16_t item_cnt;
 	uint16_t bytes_used;
 	uint16_t bytes_available;
+	uint32_t erase_cnt;
 } st_page_t;
 
 int st_init();
 int st_read_item(uint16_t item_idx, uint8_t *buf, int len);
 int st_write_item(uint16_t item_idx, uint8_t *buf, int len);
+int st_delete_item(uint16_t item_idx);
+int st_write_batch(st_batch_item_t *items, int cnt);
+int st_poll();
 
 
 //int st_get_ota(st_ota_t *result);
@@ -1,6 +1,15 @@
 #ifndef __UPGRADE_H__
 #define __UPGRADE_H__
 
+/**
+ * Images are hashed once after an update, later boots only compare the boot 
+ * verification record. A full md5 check is done every this many boots, 
+ * 0 - never.
+ */
+#ifndef UPGRADE_FULL_VERIFY_BOOTS
+#define UPGRADE_FULL_VERIFY_BOOTS	0
+#endif
+
 void upgrade_init();
 void upgrade_run();
 int upgrade_app_available();
@@ -36,4 +36,49 @@ typedef struct {
 
 uint32_t crc_check(crc_type_t *crc_type, const uint8_t * buffer, uint32_t length); 
 
+/*
+ * Table driven engine. Tables are generated on first use from any preset 
+ * above, "slices" selects byte-wise(1) or slicing-by-4/8 processing. Entries 
+ * are sized by the CRC width, each slice takes 256 bytes up to 8 bits, 512 
+ * bytes up to 16 bits and 1KB above.
+ *   CRC_TABLE_DEFINE(crc32_tab, CRC32_INIT, 32, 4);
+ *   crc_ctx_t ctx;
+ *   crc_init(&ctx, &crc32_tab);
+ *   crc_update(&ctx, buf, len);
+ *   crc = crc_final(&ctx);
+ * A table generated offline can be kept in flash with CRC_TABLE_CONST, 
+ * crc8_maxim_table is provided that way.
+ */
+typedef struct {
+    crc_type_t type;
+    uint8_t slices;
+    uint8_t ready;
+    uint8_t entry;          //bytes per entry, CRC_TABLE_ENTRY(width)
+    const void *table;      //[slices][256] entries
+} crc_table_t;
+
+#define CRC_TABLE_ENTRY(width) ((width) <= 8 ? 1 : ((width) <= 16 ? 2 : 4))
+
+//"width" must be at least the width of "preset"
+#define CRC_TABLE_DEFINE(name, preset, width, n) \
+    static uint8_t name##_data[n][256 * CRC_TABLE_ENTRY(width)] __attribute__((aligned(4))); \
+    static crc_table_t name = {preset, n, 0, CRC_TABLE_ENTRY(width), name##_data}
+
+//"data" holds the entries crc_table_init would generate
+#define CRC_TABLE_CONST(preset, width, n, data) \
+    {preset, n, 1, CRC_TABLE_ENTRY(width), data}
+
+extern crc_table_t crc8_maxim_table;
+
+typedef struct {
+    crc_table_t *tab;
+    uint32_t reg;
+} crc_ctx_t;
+
+void crc_table_init(crc_table_t *tab);
+void crc_init(crc_ctx_t *ctx, crc_table_t *tab);
+void crc_update(crc_ctx_t *ctx, const uint8_t *buffer, uint32_t length);
+uint32_t crc_final(crc_ctx_t *ctx);
+uint32_t crc_table_check(crc_table_t *tab, const uint8_t *buffer, uint32_t length);
+
 #endif
\ No newline at end of file
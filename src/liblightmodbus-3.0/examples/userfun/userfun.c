@@ -71,6 +71,10 @@ int main(void)
 		1);
 	assert(modbusIsOk(err));
 
+	// Optional - dispatch requests with a table lookup instead of a search
+	static uint8_t functionIndex[256];
+	modbusSlaveBuildFunctionIndex(&slave, functionIndex);
+
 	// Request frame with odd number
 	uint8_t request[] = {65, 33};
 
@@ -29,6 +29,22 @@
 #define LIGHTMODBUS_ALWAYS_INLINE __attribute__((always_inline))
 #endif
 
+/**
+	\def LIGHTMODBUS_CRC_TABLE
+	\brief Computes Modbus CRC with a 512-byte lookup table instead of the bitwise loop
+
+	Without this or LIGHTMODBUS_CRC_SLICE4, CRC is computed bit by bit, which
+	needs no tables but is several times slower.
+*/
+
+/**
+	\def LIGHTMODBUS_CRC_SLICE4
+	\brief Computes Modbus CRC four bytes at a time with 2KB of lookup tables
+*/
+#if defined(LIGHTMODBUS_CRC_TABLE) && defined(LIGHTMODBUS_CRC_SLICE4)
+#error "LIGHTMODBUS_CRC_TABLE and LIGHTMODBUS_CRC_SLICE4 are mutually exclusive"
+#endif
+
 #define MODBUS_PDU_MIN 1   //!< Minimum length of a PDU
 #define MODBUS_PDU_MAX 253 //!< Maximum length of a PDU
 
@@ -234,6 +250,7 @@ typedef enum ModbusExceptionCode
 	MODBUS_EXCEP_ILLEGAL_VALUE = 3,    //!< Illegal data value
 	MODBUS_EXCEP_SLAVE_FAILURE = 4,    //!< Slave could not process the request
 	MODBUS_EXCEP_ACK = 5,              //!< Acknowledge
+	MODBUS_EXCEP_BUSY = 6,             //!< Slave device busy
 	MODBUS_EXCEP_NACK = 7              //!< Negative acknowledge
 } ModbusExceptionCode;
 
@@ -295,7 +312,11 @@ void modbusBufferDestroy(ModbusBuffer *buffer, void *context);
 LIGHTMODBUS_WARN_UNUSED ModbusError modbusBufferAllocateADU(ModbusBuffer *buffer, uint16_t pduSize, void *context);
 void modbusBufferFree(ModbusBuffer *buffer, void *context);
 
+#define MODBUS_CRC_INIT 0xFFFF //!< Initial value of Modbus CRC accumulated with modbusCRCUpdate()
+
 uint16_t modbusCRC(const uint8_t *data, uint16_t length);
+uint16_t modbusCRCUpdate(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t modbusCRCByte(uint16_t crc, uint8_t byte);
 
 /**
 	\brief Prepares buffer to only store a Modbus PDU
@@ -74,6 +74,7 @@ const char *modbusExceptionCodeStr(ModbusExceptionCode code)
 		ECASE(MODBUS_EXCEP_ILLEGAL_VALUE);
 		ECASE(MODBUS_EXCEP_SLAVE_FAILURE);
 		ECASE(MODBUS_EXCEP_ACK);
+		ECASE(MODBUS_EXCEP_BUSY);
 		ECASE(MODBUS_EXCEP_NACK);
 
 		default: return "[invalid ModbusExceptionCode]";
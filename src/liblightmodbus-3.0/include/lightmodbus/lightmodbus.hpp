@@ -198,6 +198,21 @@ public:
 		modbusSlaveSetUserPointer(&m_slave, ptr);
 	}
 
+	void buildFunctionIndex(uint8_t index[256])
+	{
+		modbusSlaveBuildFunctionIndex(&m_slave, index);
+	}
+
+	void setRangeCallback(ModbusRangeCallback callback)
+	{
+		modbusSlaveSetRangeCallback(&m_slave, callback);
+	}
+
+	void setRegisterMap(const ModbusRegisterMapEntry *map, uint8_t size)
+	{
+		modbusSlaveSetRegisterMap(&m_slave, map, size);
+	}
+
 	void *getUserPointer() const
 	{
 		return modbusSlaveGetUserPointer(&m_slave);
@@ -405,6 +420,11 @@ public:
 		modbusMasterSetUserPointer(&m_master, ptr);
 	}
 
+	void buildFunctionIndex(uint8_t index[256])
+	{
+		modbusMasterBuildFunctionIndex(&m_master, index);
+	}
+
 	void *getUserPointer() const
 	{
 		return modbusMasterGetUserPointer(&m_master);
@@ -76,6 +76,7 @@ struct ModbusMaster
 
 	const ModbusMasterFunctionHandler *functions; //!< A non-owning pointer to array of function handlers
 	uint8_t functionCount; //!< Size of \ref functions array
+	const uint8_t *functionIndex; //!< Function code to handler lookup table (optional, see modbusMasterBuildFunctionIndex())
 
 	//! Stores master's request for slave
 	ModbusBuffer request;
@@ -92,6 +93,7 @@ LIGHTMODBUS_RET_ERROR modbusMasterInit(
 	uint8_t functionCount);
 
 void modbusMasterDestroy(ModbusMaster *status);
+void modbusMasterBuildFunctionIndex(ModbusMaster *status, uint8_t index[256]);
 
 LIGHTMODBUS_RET_ERROR modbusBeginRequestPDU(ModbusMaster *status);
 LIGHTMODBUS_RET_ERROR modbusEndRequestPDU(ModbusMaster *status);
@@ -88,11 +88,30 @@ LIGHTMODBUS_RET_ERROR modbusMasterInit(
 	status->exceptionCallback = exceptionCallback;
 	status->functions = functions;
 	status->functionCount = functionCount;
+	status->functionIndex = NULL;
 	status->context = NULL;
 
 	return modbusBufferInit(&status->request, allocator);
 }
 
+/**
+	\brief Builds a direct lookup table for the master's function handlers
+	\param index table of 256 entries, owned by the caller. Its lifetime must not
+		be shorter than the lifetime of the master.
+	\see modbusSlaveBuildFunctionIndex()
+*/
+void modbusMasterBuildFunctionIndex(ModbusMaster *status, uint8_t index[256])
+{
+	for (uint16_t i = 0; i < 256; i++)
+		index[i] = 0;
+
+	// Entries hold handler position + 1, 0 means no handler
+	for (uint16_t i = status->functionCount; i > 0; i--)
+		index[status->functions[i - 1].id] = i;
+
+	status->functionIndex = index;
+}
+
 /**
 	\brief Deinitializes a ModbusMaster struct
 	\param status ModbusMaster struct to be destroyed
@@ -228,6 +247,22 @@ LIGHTMODBUS_RET_ERROR modbusParseResponsePDU(
 	if (function != request[0])
 		return MODBUS_RESPONSE_ERROR(FUNCTION);
 
+	// Look up the parsing function directly if there's an index
+	if (status->functionIndex)
+	{
+		uint8_t i = status->functionIndex[function];
+		if (i)
+			return status->functions[i - 1].ptr(
+				status,
+				address,
+				function,
+				request,
+				requestLength,
+				response,
+				responseLength);
+		return MODBUS_GENERAL_ERROR(FUNCTION);
+	}
+
 	// Find a parsing function
 	for (uint16_t i = 0; i < status->functionCount; i++)
 		if (function == status->functions[i].id)
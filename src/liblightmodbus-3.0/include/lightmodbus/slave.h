@@ -71,6 +71,53 @@ typedef ModbusError (*ModbusRegisterCallback)(
 	const ModbusRegisterCallbackArgs *args,
 	ModbusRegisterCallbackResult *out);
 
+/**
+	\brief Contains arguments for the register range callback
+*/
+typedef struct ModbusRangeCallbackArgs
+{
+	ModbusDataType type;        //!< Type of accessed data (holding or input registers)
+	ModbusRegisterQuery query;  //!< Type of request made to the range
+	uint16_t index;             //!< Index of the first register
+	uint16_t count;             //!< Number of registers
+	const uint8_t *values;      //!< Big-endian values to be written (W_CHECK and W only)
+	uint8_t *buffer;            //!< Space for `count` big-endian values read (R only)
+	uint8_t function;           //!< Function accessing the range
+} ModbusRangeCallbackArgs;
+
+/**
+	\brief A pointer to callback accessing a contiguous block of registers at once
+	\see modbusSlaveSetRangeCallback()
+*/
+typedef ModbusError (*ModbusRangeCallback)(
+	const ModbusSlave *status,
+	const ModbusRangeCallbackArgs *args,
+	ModbusRegisterCallbackResult *out);
+
+/**
+	\brief A pointer to a hook called around each write to a mapped register
+	\returns nonzero from `beforeWrite` to leave the register unchanged
+*/
+typedef ModbusError (*ModbusRegisterMapHook)(
+	const ModbusSlave *status,
+	uint16_t index,
+	uint16_t value);
+
+/**
+	\brief Maps a range of registers to an array in memory
+	\see modbusSlaveSetRegisterMap()
+*/
+typedef struct ModbusRegisterMapEntry
+{
+	ModbusDataType type;                //!< Holding or input registers
+	uint16_t index;                     //!< Index of the first register
+	uint16_t count;                     //!< Number of registers
+	uint16_t *data;                     //!< Backing array of `count` values, native byte order
+	uint8_t writable;                   //!< Nonzero if the registers can be written
+	ModbusRegisterMapHook beforeWrite;  //!< Called before each register is written (optional)
+	ModbusRegisterMapHook afterWrite;   //!< Called after each register is written (optional)
+} ModbusRegisterMapEntry;
+
 /**
 	\brief A pointer to a callback called when a Modbus exception is generated (for slave)
 	\see slave-exception-callback
@@ -90,8 +137,12 @@ struct ModbusSlave
 {
 	ModbusRegisterCallback registerCallback;        //!< A pointer to register callback (required)
 	ModbusSlaveExceptionCallback exceptionCallback; //!< A pointer to exception callback (optional)
+	ModbusRangeCallback rangeCallback;              //!< A pointer to register range callback (optional)
+	const ModbusRegisterMapEntry *registerMap;      //!< Registers served straight from memory (optional)
+	uint8_t registerMapSize;                        //!< Number of entries in `registerMap`
 	const ModbusSlaveFunctionHandler *functions;    //!< A pointer to an array of function handlers (required)
 	uint8_t functionCount;                          //!< Number of function handlers in the array (`functions`)
+	const uint8_t *functionIndex;                   //!< Function code to handler lookup table (optional, see modbusSlaveBuildFunctionIndex())
 	
 	//! Stores slave's response to master
 	ModbusBuffer response;
@@ -109,6 +160,7 @@ LIGHTMODBUS_RET_ERROR modbusSlaveInit(
 	uint8_t functionCount);
 
 void modbusSlaveDestroy(ModbusSlave *status);
+void modbusSlaveBuildFunctionIndex(ModbusSlave *status, uint8_t index[256]);
 
 LIGHTMODBUS_RET_ERROR modbusBuildException(
 	ModbusSlave *status,
@@ -136,6 +188,7 @@ LIGHTMODBUS_RET_ERROR modbusBuildExceptionTCP(
 LIGHTMODBUS_RET_ERROR modbusParseRequest(ModbusSlave *status, const uint8_t *request, uint8_t requestLength);
 LIGHTMODBUS_RET_ERROR modbusParseRequestPDU(ModbusSlave *status, const uint8_t *request, uint8_t requestLength);
 LIGHTMODBUS_RET_ERROR modbusParseRequestRTU(ModbusSlave *status, uint8_t slaveAddress, const uint8_t *request, uint16_t requestLength);
+LIGHTMODBUS_RET_ERROR modbusParseRequestRTUWithCRC(ModbusSlave *status, uint8_t slaveAddress, const uint8_t *request, uint16_t requestLength, uint16_t frameCRC);
 LIGHTMODBUS_RET_ERROR modbusParseRequestTCP(ModbusSlave *status, const uint8_t *request, uint16_t requestLength);
 
 /**
@@ -176,6 +229,35 @@ static inline void *modbusSlaveGetUserPointer(const ModbusSlave *status)
 	return status->context;
 }
 
+/**
+	\brief Sets the register range callback used by functions 03, 04 and 16
+
+	The callback is asked once with `MODBUS_REGQ_R_CHECK` or `MODBUS_REGQ_W_CHECK`
+	for the whole block and then once more to read or write it. `out->value` is
+	not used. Returning `MODBUS_ERROR_FUNCTION` from a check query makes the
+	slave serve that request with `registerCallback`, one register at a time.
+	Coils and discrete inputs always go through `registerCallback`.
+*/
+static inline void modbusSlaveSetRangeCallback(ModbusSlave *status, ModbusRangeCallback callback)
+{
+	status->rangeCallback = callback;
+}
+
+/**
+	\brief Sets the register map used by functions 03, 04 and 16
+
+	A block of registers that lies inside one entry is read from or written to
+	the backing array directly, without calling `rangeCallback` or
+	`registerCallback`. Entries must be sorted by type and then by index, and
+	must not overlap. Blocks outside the map, and writes to entries that are
+	not writable, are handled by the callbacks as before.
+*/
+static inline void modbusSlaveSetRegisterMap(ModbusSlave *status, const ModbusRegisterMapEntry *map, uint8_t size)
+{
+	status->registerMap = map;
+	status->registerMapSize = size;
+}
+
 /**
 	\brief Allocates memory for slave's response frame
 	\param pduSize size of the PDU section. 0 if the slave doesn't want to respond.
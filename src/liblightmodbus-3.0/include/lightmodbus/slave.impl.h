@@ -86,13 +86,38 @@ LIGHTMODBUS_RET_ERROR modbusSlaveInit(
 {
 	status->functions = functions;
 	status->functionCount = functionCount;
+	status->functionIndex = NULL;
 	status->registerCallback = registerCallback;
 	status->exceptionCallback = exceptionCallback;
+	status->rangeCallback = NULL;
+	status->registerMap = NULL;
+	status->registerMapSize = 0;
 	status->context = NULL;
 
 	return modbusBufferInit(&status->response, allocator);
 }
 
+/**
+	\brief Builds a direct lookup table for the slave's function handlers
+	\param index table of 256 entries, owned by the caller. Its lifetime must not
+		be shorter than the lifetime of the slave.
+
+	Once built, requests are dispatched with a single table lookup instead of a
+	search through `functions`. Call this again if `functions` changes.
+	When function IDs repeat, the first handler wins, as with the search.
+*/
+void modbusSlaveBuildFunctionIndex(ModbusSlave *status, uint8_t index[256])
+{
+	for (uint16_t i = 0; i < 256; i++)
+		index[i] = 0;
+
+	// Entries hold handler position + 1, 0 means no handler
+	for (uint16_t i = status->functionCount; i > 0; i--)
+		index[status->functions[i - 1].id] = i;
+
+	status->functionIndex = index;
+}
+
 /**
 	\brief Frees memory allocated in the ModbusSlave struct
 */
@@ -250,6 +275,15 @@ LIGHTMODBUS_RET_ERROR modbusParseRequest(ModbusSlave *status, const uint8_t *req
 {
 	uint8_t function = request[0];
 
+	// Look up the handler directly if there's an index
+	if (status->functionIndex)
+	{
+		uint8_t i = status->functionIndex[function];
+		if (i)
+			return status->functions[i - 1].ptr(status, function, &request[0], requestLength);
+		return modbusBuildException(status, function, MODBUS_EXCEP_ILLEGAL_FUNCTION);
+	}
+
 	// Look for matching function
 	for (uint16_t i = 0; i < status->functionCount; i++)
 		if (function == status->functions[i].id)
@@ -283,20 +317,15 @@ LIGHTMODBUS_RET_ERROR modbusParseRequestPDU(ModbusSlave *status, const uint8_t *
 }
 
 /**
-	\brief Parses provided Modbus RTU request frame and generates a Modbus RTU response
-	\param slaveAddress ID of the slave to match with the request
-	\param request pointer to a Modbus RTU frame
-	\param requestLength length of the frame (valid range: 4 - 256)
-	\returns MODBUS_REQUEST_ERROR(LENGTH) if length of the frame is invalid
-	\returns MODBUS_REQUEST_ERROR(CRC) if CRC is invalid
-	\returns MODBUS_REQUEST_ERROR(ADDRESS) if the request is meant for other slave
-	\returns MODBUS_GENERAL_ERROR(LENGTH) if the resulting response frame has invalid length
-	\returns Any errors from parsing functions
-
-	\warning The response frame can only be accessed if modbusIsOk() called 
-		on the return value of this function evaluates to true.
+	\brief Common part of modbusParseRequestRTU() and modbusParseRequestRTUWithCRC()
+	\param checkCRC Controls whether the CRC of the frame should be checked
 */
-LIGHTMODBUS_RET_ERROR modbusParseRequestRTU(ModbusSlave *status, uint8_t slaveAddress, const uint8_t *request, uint16_t requestLength)
+LIGHTMODBUS_WARN_UNUSED LIGHTMODBUS_ALWAYS_INLINE static inline ModbusErrorInfo modbusParseRequestRTUFrame(
+	ModbusSlave *status,
+	uint8_t slaveAddress,
+	const uint8_t *request,
+	uint16_t requestLength,
+	uint8_t checkCRC)
 {
 	// Unpack the request
 	const uint8_t *pdu;
@@ -305,7 +334,7 @@ LIGHTMODBUS_RET_ERROR modbusParseRequestRTU(ModbusSlave *status, uint8_t slaveAd
 	ModbusError err = modbusUnpackRTU(
 		request,
 		requestLength,
-		1,
+		checkCRC,
 		&pdu,
 		&pduLength,
 		&requestAddress
@@ -347,6 +376,49 @@ LIGHTMODBUS_RET_ERROR modbusParseRequestRTU(ModbusSlave *status, uint8_t slaveAd
 	return MODBUS_NO_ERROR();
 }
 
+/**
+	\brief Parses provided Modbus RTU request frame and generates a Modbus RTU response
+	\param slaveAddress ID of the slave to match with the request
+	\param request pointer to a Modbus RTU frame
+	\param requestLength length of the frame (valid range: 4 - 256)
+	\returns MODBUS_REQUEST_ERROR(LENGTH) if length of the frame is invalid
+	\returns MODBUS_REQUEST_ERROR(CRC) if CRC is invalid
+	\returns MODBUS_REQUEST_ERROR(ADDRESS) if the request is meant for other slave
+	\returns MODBUS_GENERAL_ERROR(LENGTH) if the resulting response frame has invalid length
+	\returns Any errors from parsing functions
+
+	\warning The response frame can only be accessed if modbusIsOk() called 
+		on the return value of this function evaluates to true.
+*/
+LIGHTMODBUS_RET_ERROR modbusParseRequestRTU(ModbusSlave *status, uint8_t slaveAddress, const uint8_t *request, uint16_t requestLength)
+{
+	return modbusParseRequestRTUFrame(status, slaveAddress, request, requestLength, 1);
+}
+
+/**
+	\brief Same as modbusParseRequestRTU(), but with the CRC accumulated by the caller
+	\param slaveAddress ID of the slave to match with the request
+	\param request pointer to a Modbus RTU frame
+	\param requestLength length of the frame (valid range: 4 - 256)
+	\param frameCRC Modbus CRC of the whole frame, including its CRC field
+	\returns Same as modbusParseRequestRTU()
+
+	The CRC of a valid frame together with its own CRC field is always 0,
+	so a receiver feeding every byte into modbusCRCByte() as it arrives has
+	the frame checked by the time the frame ends, and the frame is not
+	scanned again here.
+*/
+LIGHTMODBUS_RET_ERROR modbusParseRequestRTUWithCRC(ModbusSlave *status, uint8_t slaveAddress, const uint8_t *request, uint16_t requestLength, uint16_t frameCRC)
+{
+	if (requestLength < MODBUS_RTU_ADU_MIN || requestLength > MODBUS_RTU_ADU_MAX)
+		return MODBUS_REQUEST_ERROR(LENGTH);
+
+	if (frameCRC != 0)
+		return MODBUS_REQUEST_ERROR(CRC);
+
+	return modbusParseRequestRTUFrame(status, slaveAddress, request, requestLength, 0);
+}
+
 /**
 	\brief Parses provided Modbus TCP request frame and generates a Modbus TCP response
 	\param request pointer to a Modbus TCP frame
@@ -9,6 +9,68 @@
 	\brief Slave's functions for parsing requests (implementation)
 */
 
+/**
+	\brief Looks up the register map entry holding the whole block
+	\returns NULL if the block is not mapped, or is not writable when `write` is set
+*/
+static inline const ModbusRegisterMapEntry *modbusRegisterMapFind(
+	const ModbusSlave *status,
+	ModbusDataType type,
+	uint16_t index,
+	uint16_t count,
+	uint8_t write)
+{
+	const ModbusRegisterMapEntry *map = status->registerMap;
+	unsigned int lo = 0, hi = status->registerMapSize;
+
+	// Find the last entry starting at or before (type, index)
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) >> 1;
+		if (map[mid].type < type || (map[mid].type == type && map[mid].index <= index))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return NULL;
+
+	const ModbusRegisterMapEntry *entry = &map[lo - 1];
+	if (entry->type != type || (uint32_t) index + count > (uint32_t) entry->index + entry->count)
+		return NULL;
+	if (write && !entry->writable)
+		return NULL;
+	return entry;
+}
+
+/**
+	\brief Asks the range callback whether it serves the block
+	\returns 1 if the block is served by the range callback, 0 if it has to go
+		through the register callback, -1 if the request failed (the exception
+		response has been built and `err` holds the result)
+*/
+static inline int modbusRangeCheck(
+	ModbusSlave *status,
+	const ModbusRangeCallbackArgs *args,
+	ModbusErrorInfo *err)
+{
+	ModbusRegisterCallbackResult cres = {MODBUS_EXCEP_NONE, 0};
+	if (!status->rangeCallback)
+		return 0;
+
+	ModbusError fail = status->rangeCallback(status, args, &cres);
+	if (fail == MODBUS_ERROR_FUNCTION)
+		return 0;
+	if (fail)
+		cres.exceptionCode = MODBUS_EXCEP_SLAVE_FAILURE;
+	if (cres.exceptionCode)
+	{
+		*err = modbusBuildException(status, args->function, cres.exceptionCode);
+		return -1;
+	}
+	return 1;
+}
+
 /**
 	\brief Handles requests 01, 02, 03 and 04 (Read Multiple XX) and generates response.
 	\param function function code
@@ -83,8 +145,25 @@ LIGHTMODBUS_RET_ERROR modbusParseRequest01020304(
 		.function = function,
 	};
 
+	ModbusRangeCallbackArgs rargs = {
+		.type = datatype,
+		.query = MODBUS_REGQ_R_CHECK,
+		.index = index,
+		.count = count,
+		.values = NULL,
+		.buffer = NULL,
+		.function = function,
+	};
+
+	// Mapped registers need no checks, others may be checked as a block
+	ModbusErrorInfo err;
+	const ModbusRegisterMapEntry *entry = isCoilType ? NULL : modbusRegisterMapFind(status, datatype, index, count, 0);
+	int inRange = (isCoilType || entry) ? 0 : modbusRangeCheck(status, &rargs, &err);
+	if (inRange < 0)
+		return err;
+
 	// Check if all registers can be read
-	for (uint16_t i = 0; i < count; i++)
+	for (uint16_t i = 0; !entry && !inRange && i < count; i++)
 	{
 		cargs.index = index + i;
 		ModbusError fail = status->registerCallback(status, &cargs, &cres);
@@ -105,6 +184,23 @@ LIGHTMODBUS_RET_ERROR modbusParseRequest01020304(
 	for (uint8_t i = 0; i < dataLength; i++)
 		status->response.pdu[2 + i] = 0;
 
+	if (entry)
+	{
+		const uint16_t *data = entry->data + (index - entry->index);
+		for (uint16_t i = 0; i < count; i++)
+			modbusWBE(&status->response.pdu[2 + (i << 1)], data[i]);
+		return MODBUS_NO_ERROR();
+	}
+
+	if (inRange)
+	{
+		ModbusRegisterCallbackResult rres;
+		rargs.query = MODBUS_REGQ_R;
+		rargs.buffer = &status->response.pdu[2];
+		(void) status->rangeCallback(status, &rargs, &rres);
+		return MODBUS_NO_ERROR();
+	}
+
 	cargs.query = MODBUS_REGQ_R;
 	for (uint16_t i = 0; i < count; i++)
 	{
@@ -228,8 +324,26 @@ LIGHTMODBUS_RET_ERROR modbusParseRequest1516(
 		.function = function,
 	};
 
+	ModbusRangeCallbackArgs rargs = {
+		.type = datatype,
+		.query = MODBUS_REGQ_W_CHECK,
+		.index = index,
+		.count = count,
+		.values = &requestPDU[6],
+		.buffer = NULL,
+		.function = function,
+	};
+
+	// Mapped registers need no checks, others may be checked as a block
+	ModbusErrorInfo err;
+	uint8_t isCoilType = datatype == MODBUS_COIL;
+	const ModbusRegisterMapEntry *entry = isCoilType ? NULL : modbusRegisterMapFind(status, datatype, index, count, 1);
+	int inRange = (isCoilType || entry) ? 0 : modbusRangeCheck(status, &rargs, &err);
+	if (inRange < 0)
+		return err;
+
 	// Check write access
-	for (uint16_t i = 0; i < count; i++)
+	for (uint16_t i = 0; !entry && !inRange && i < count; i++)
 	{
 		cargs.index = index + i;
 		cargs.value = datatype == MODBUS_COIL ? modbusMaskRead(&requestPDU[6], i) : modbusRBE(&requestPDU[6 + (i << 1)]);
@@ -238,9 +352,25 @@ LIGHTMODBUS_RET_ERROR modbusParseRequest1516(
 		if (cres.exceptionCode) return modbusBuildException(status, function, cres.exceptionCode);
 	}
 
+	// Write mapped holding registers straight into their array
+	for (uint16_t i = 0; entry && i < count; i++)
+	{
+		uint16_t value = modbusRBE(&requestPDU[6 + (i << 1)]);
+		if (entry->beforeWrite && entry->beforeWrite(status, index + i, value))
+			continue;
+		entry->data[index + i - entry->index] = value;
+		if (entry->afterWrite)
+			(void) entry->afterWrite(status, index + i, value);
+	}
+
+	ModbusRegisterCallbackResult rres;
+	rargs.query = MODBUS_REGQ_W;
+	if (inRange)
+		(void) status->rangeCallback(status, &rargs, &rres);
+
 	// Write coils
 	cargs.query = MODBUS_REGQ_W;
-	for (uint16_t i = 0; i < count; i++)
+	for (uint16_t i = 0; !entry && !inRange && i < count; i++)
 	{
 		cargs.index = index + i;
 		cargs.value = datatype == MODBUS_COIL ? modbusMaskRead(&requestPDU[6], i) : modbusRBE(&requestPDU[6 + (i << 1)]);
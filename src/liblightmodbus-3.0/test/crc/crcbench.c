@@ -0,0 +1,97 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LIGHTMODBUS_IMPL
+#include <lightmodbus/lightmodbus.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles/byte"
+static uint64_t benchTicks(void)
+{
+	return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns/byte"
+static uint64_t benchTicks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+#endif
+
+#if defined(LIGHTMODBUS_CRC_SLICE4)
+#define BENCH_BACKEND "slice4"
+#elif defined(LIGHTMODBUS_CRC_TABLE)
+#define BENCH_BACKEND "table"
+#else
+#define BENCH_BACKEND "bitwise"
+#endif
+
+#define BENCH_BYTES (16u * 1024u * 1024u)
+
+// Reference implementation, the original bitwise loop
+static uint16_t referenceCRC(const uint8_t *data, uint16_t length)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+static int verify(const uint8_t *data, uint16_t length)
+{
+	uint16_t expected = referenceCRC(data, length);
+	uint16_t crc = MODBUS_CRC_INIT;
+	uint16_t split = length ? rand() % length : 0;
+
+	if (modbusCRC(data, length) != expected)
+		return 1;
+
+	crc = modbusCRCUpdate(crc, data, split);
+	for (uint16_t i = split; i < length; i++)
+		crc = modbusCRCByte(crc, data[i]);
+	return crc != expected;
+}
+
+static double measure(const uint8_t *data, uint16_t length)
+{
+	volatile uint16_t sink = 0;
+	uint32_t rounds = BENCH_BYTES / length;
+	uint64_t start = benchTicks();
+	for (uint32_t i = 0; i < rounds; i++)
+		sink ^= modbusCRC(data, length);
+	return (double)(benchTicks() - start) / ((double) rounds * length);
+}
+
+int main(void)
+{
+	static const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+	static const uint16_t lengths[] = {8, 256};
+	uint8_t data[256];
+	int errors = 0;
+
+	srand(1);
+	for (unsigned i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	if (modbusCRC(check, sizeof(check)) != 0x4B37)
+		errors++;
+	for (int i = 0; i < 1000; i++)
+		errors += verify(data, rand() % (sizeof(data) + 1));
+
+	for (unsigned i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+		printf("%-8s %4u-byte frame: %6.2f " BENCH_UNIT "\n",
+			BENCH_BACKEND, lengths[i], measure(data, lengths[i]));
+
+	if (errors)
+		printf("%s: %d CRC mismatches\n", BENCH_BACKEND, errors);
+	return errors != 0;
+}
@@ -199,6 +199,24 @@ void modbus_rtu_tests()
 		assert_slave_err(MODBUS_REQUEST_ERROR(CRC));
 	});
 
+	run_test("Parse a raw Modbus RTU request with running CRC", [](){
+		set_mode("rtu-crc");
+		set_request({0x01, 0x06, 0xab, 0xcd, 0x01, 0x23, 0x78, 0x58});
+		parse_request();
+		assert_slave_ok();
+		assert_reg(0xabcd, 0x0123);
+		parse_response();
+		assert_master_ok();
+
+		set_request({0x01, 0x06, 0xab, 0xcd, 0x01, 0x23, 0xfa, 0xce});
+		parse_request();
+		assert_slave_err(MODBUS_REQUEST_ERROR(CRC));
+
+		set_request({0x01, 0x06, 0xab});
+		parse_request();
+		assert_slave_err(MODBUS_REQUEST_ERROR(LENGTH));
+	});
+
 	run_test("Parse a raw Modbus RTU response (exception)", [](){
 		build_request({1, 1, 0, 1});
 		set_response({1, 0x81, 1, 0x81, 0x90});
@@ -753,6 +771,42 @@ void illegal_function_test()
 	});
 }
 
+void function_index_tests()
+{
+	run_test("Dispatch through the function index", [](){
+		set_mode("pdu");
+		set_function_index(1);
+		build_request({1, 16, 0x10, 2, 0x1234, 0x5678});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg(0x11, 0x5678);
+		parse_response();
+		assert_master_ok();
+
+		build_request({1, 3, 0x10, 2});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		parse_response();
+		assert_master_ok();
+		assert_expr("data read back", response_data.size() == 6
+			&& response_data[4] == 0x56 && response_data[5] == 0x78);
+	});
+
+	run_test("Call function 0x7f through the function index", [](){
+		set_mode("pdu");
+		set_function_index(1);
+		set_request({0x7f, 0xde, 0xad, 0xbe, 0xef});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_ILLEGAL_FUNCTION);
+
+		set_response({0x7f, 0xc0, 0xff, 0xee, 0x33});
+		parse_response();
+		assert_master_err(MODBUS_GENERAL_ERROR(FUNCTION));
+	});
+}
+
 void invalid_response_tests()
 {
 	run_test("[03 resp] Invalid declared data count", [](){
@@ -861,6 +915,135 @@ void invalid_response_tests()
 	});
 }
 
+void range_callback_tests()
+{
+	run_test("Read 125 registers through the range callback", [](){
+		set_mode("pdu");
+		set_range_limit(0x200);
+		for (int i = 0; i < 125; i++)
+			regs.at(0x80 + i) = 0x1200 + i;
+		build_request({1, 3, 0x80, 125});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_range_queries(2);
+		assert_reg_queries(0);
+		parse_response();
+		assert_master_ok();
+		assert_expr("data read back", response_data.size() == 252
+			&& response_data[2] == 0x12 && response_data[3] == 0x00
+			&& response_data[250] == 0x12 && response_data[251] == 0x7c);
+	});
+
+	run_test("Read a locked register through the range callback", [](){
+		set_mode("pdu");
+		set_range_limit(0x200);
+		set_rlock(0x105, 1);
+		build_request({1, 4, 0x100, 8});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_SLAVE_FAILURE);
+		assert_range_queries(1);
+	});
+
+	run_test("Write 4 registers through the range callback", [](){
+		set_mode("pdu");
+		set_range_limit(0x200);
+		build_request({1, 16, 0x00ff, 4, 17, 18, 19, 20});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_range_queries(2);
+		assert_reg_queries(0);
+		assert_reg(0x00ff, 17);
+		assert_reg(0x0102, 20);
+		parse_response();
+		assert_master_ok();
+
+		set_wlock(0x0101, 1);
+		build_request({1, 16, 0x00ff, 4, 1, 2, 3, 4});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_SLAVE_FAILURE);
+		assert_reg(0x00ff, 17);
+	});
+
+	run_test("Range callback declines a block", [](){
+		set_mode("pdu");
+		set_range_limit(0x100);
+		build_request({1, 16, 0x00ff, 2, 33, 44});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_range_queries(1);
+		assert_reg_queries(4);
+		assert_reg(0x0100, 44);
+
+		build_request({1, 1, 0, 8});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_range_queries(0);
+		assert_reg_queries(16);
+	});
+}
+
+void register_map_tests()
+{
+	run_test("Read registers through the register map", [](){
+		set_mode("pdu");
+		set_register_map(1);
+		for (int i = 0; i < 0x80; i++)
+			regs.at(i) = 0x5500 + i;
+		build_request({1, 3, 0x7c, 4});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg_queries(0);
+		assert_expr("data read back", response_data.size() == 10
+			&& response_data[2] == 0x55 && response_data[3] == 0x7c
+			&& response_data[8] == 0x55 && response_data[9] == 0x7f);
+		parse_response();
+		assert_master_ok();
+
+		build_request({1, 4, 0x10, 16});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg_queries(0);
+
+		// Wrong type and blocks reaching past an entry use the callback
+		build_request({1, 3, 0x10, 2});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg_queries(4);
+
+		build_request({1, 4, 0x1f, 2});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg_queries(4);
+	});
+
+	run_test("Write registers through the register map", [](){
+		set_mode("pdu");
+		set_register_map(1);
+		build_request({1, 16, 0x40, 4, 1, 0xdead, 3, 4});
+		parse_request();
+		assert_slave_ok();
+		assert_slave_ex(MODBUS_EXCEP_NONE);
+		assert_reg_queries(0);
+		assert_map_writes(3);
+		assert_reg(0x40, 1);
+		assert_reg(0x41, 0);
+		assert_reg(0x43, 4);
+		parse_response();
+		assert_master_ok();
+
+		set_wlock(0x80, 1);
+		build_request({1, 16, 0x7f, 2, 5, 6});
+		parse_request();
+		assert_slave_ex(MODBUS_EXCEP_SLAVE_FAILURE);
+		assert_reg_queries(2);
+		assert_reg(0x7f, 0);
+	});
+}
+
 void test_main()
 {
 	modbus_pdu_tests();
@@ -872,6 +1055,9 @@ void test_main()
 	single_write_tests();
 	multiple_write_tests();
 	mask_write_test();
+	range_callback_tests();
+	register_map_tests();
+	function_index_tests();
 
 	last_register_tests();
 	max_read_tests();
@@ -45,9 +45,14 @@ std::vector<uint8_t> read_locks(65536, 0);
 std::vector<uint8_t> write_locks(65536, 0);
 std::vector<ModbusDataCallbackArgs> received_data;
 std::vector<ModbusRegisterCallbackArgs> reg_queries;
+std::vector<ModbusRangeCallbackArgs> range_queries;
+int range_limit = 0;
+int map_writes = 0;
+ModbusRegisterMapEntry register_map[2];
 std::vector<uint8_t> request_data;
 std::vector<uint8_t> response_data;
 modbus_flavor modbus_mode = MODBUS_PDU;
+bool rtu_running_crc = false;
 ModbusMaster master;
 ModbusErrorInfo master_error;
 ModbusSlave slave;
@@ -110,6 +115,55 @@ ModbusError registerCallback(
 	return MODBUS_OK;
 }
 
+ModbusError rangeCallback(
+	const ModbusSlave *slave,
+	const ModbusRangeCallbackArgs *args,
+	ModbusRegisterCallbackResult *result)
+{
+	range_queries.push_back(*args);
+	result->exceptionCode = MODBUS_EXCEP_NONE;
+
+	switch (args->query)
+	{
+		case MODBUS_REGQ_R_CHECK:
+		case MODBUS_REGQ_W_CHECK:
+			// Blocks reaching past range_limit are left to registerCallback
+			if (args->index + args->count > range_limit)
+				return MODBUS_ERROR_FUNCTION;
+			for (int i = 0; i < args->count; i++)
+			{
+				const auto &locks = args->query == MODBUS_REGQ_R_CHECK ? read_locks : write_locks;
+				if (locks[args->index + i])
+					result->exceptionCode = MODBUS_EXCEP_SLAVE_FAILURE;
+			}
+			break;
+
+		case MODBUS_REGQ_R:
+			for (int i = 0; i < args->count; i++)
+				modbusWBE(&args->buffer[i << 1], regs.at(args->index + i));
+			break;
+
+		case MODBUS_REGQ_W:
+			for (int i = 0; i < args->count; i++)
+				regs.at(args->index + i) = modbusRBE(&args->values[i << 1]);
+			break;
+	}
+
+	return MODBUS_OK;
+}
+
+ModbusError mapBeforeWrite(const ModbusSlave *slave, uint16_t index, uint16_t value)
+{
+	// 0xdead is never stored
+	return value == 0xdead ? MODBUS_ERROR_VALUE : MODBUS_OK;
+}
+
+ModbusError mapAfterWrite(const ModbusSlave *slave, uint16_t index, uint16_t value)
+{
+	map_writes++;
+	return MODBUS_OK;
+}
+
 ModbusError slaveExceptionCallback(const ModbusSlave *slave, uint8_t function, ModbusExceptionCode code)
 {
 	// printf("Slave %d exception %s (function %d)\n", address, modbusExceptionCodeStr(code), function);
@@ -325,6 +379,7 @@ void parse_request()
 
 	response_data.clear();
 	reg_queries.clear();
+	range_queries.clear();
 	slave_exception.reset();
 
 	switch (modbus_mode)
@@ -337,6 +392,21 @@ void parse_request()
 			break;
 
 		case MODBUS_RTU:
+			if (rtu_running_crc)
+			{
+				uint16_t crc = MODBUS_CRC_INIT;
+				for (auto byte : request_data)
+					crc = modbusCRCByte(crc, byte);
+
+				slave_error = modbusParseRequestRTUWithCRC(
+					&slave,
+					1,
+					request_data.data(),
+					request_data.size(),
+					crc);
+				break;
+			}
+
 			slave_error = modbusParseRequestRTU(
 				&slave,
 				1,
@@ -564,10 +634,17 @@ void assert_expr(const std::string &message, bool expr)
 
 void set_mode(const std::string &m)
 {
+	rtu_running_crc = false;
 	if (m == "pdu")
 		modbus_mode = MODBUS_PDU;
 	else if (m == "rtu")
 		modbus_mode = MODBUS_RTU;
+	else if (m == "rtu-crc")
+	{
+		// RTU with the CRC accumulated byte by byte as a receiver would
+		modbus_mode = MODBUS_RTU;
+		rtu_running_crc = true;
+	}
 	else if (m == "tcp")
 		modbus_mode = MODBUS_TCP;
 	else
@@ -622,6 +699,60 @@ void set_wlock(int index, int lock)
 	write_locks.at(index) = lock != 0;
 }
 
+void set_range_limit(int limit)
+{
+	if (limit < 0 || limit > 65536)
+		throw std::runtime_error{"invalid set_range_limit()"};
+	range_limit = limit;
+	modbusSlaveSetRangeCallback(&slave, limit ? rangeCallback : NULL);
+}
+
+void set_register_map(int on)
+{
+	// Input registers 0x10-0x1f read-only, holding registers 0x40-0x7f writable
+	register_map[0] = {MODBUS_HOLDING_REGISTER, 0x40, 0x40, &regs.at(0x40), 1, mapBeforeWrite, mapAfterWrite};
+	register_map[1] = {MODBUS_INPUT_REGISTER, 0x10, 0x10, &regs.at(0x10), 0, NULL, NULL};
+	map_writes = 0;
+	modbusSlaveSetRegisterMap(&slave, on ? register_map : NULL, on ? 2 : 0);
+}
+
+void assert_map_writes(int n)
+{
+	assert_message("map write hook called "s + std::to_string(n) + " times"s);
+	if (map_writes != n)
+		throw std::runtime_error{"assertion failed"};
+}
+
+void set_function_index(int on)
+{
+	static uint8_t slave_index[256];
+	static uint8_t master_index[256];
+	if (on)
+	{
+		modbusSlaveBuildFunctionIndex(&slave, slave_index);
+		modbusMasterBuildFunctionIndex(&master, master_index);
+	}
+	else
+	{
+		slave.functionIndex = NULL;
+		master.functionIndex = NULL;
+	}
+}
+
+void assert_range_queries(int n)
+{
+	assert_message("range callback called "s + std::to_string(n) + " times"s);
+	if (range_queries.size() != static_cast<size_t>(n))
+		throw std::runtime_error{"assertion failed"};
+}
+
+void assert_reg_queries(int n)
+{
+	assert_message("register callback called "s + std::to_string(n) + " times"s);
+	if (reg_queries.size() != static_cast<size_t>(n))
+		throw std::runtime_error{"assertion failed"};
+}
+
 void reset()
 {
 	set_coil_count(65536);
@@ -635,6 +766,9 @@ void reset()
 
 	clear_coils(0);
 	clear_regs(0);
+	set_range_limit(0);
+	set_register_map(0);
+	set_function_index(0);
 
 	slave_exception.reset();
 	master_exception.reset();
@@ -42,6 +42,12 @@ void clear_regs(int val);
 void clear_coils(int val);
 void set_rlock(int index, int lock);
 void set_wlock(int index, int lock);
+void set_range_limit(int limit);
+void assert_range_queries(int n);
+void assert_reg_queries(int n);
+void set_register_map(int on);
+void assert_map_writes(int n);
+void set_function_index(int on);
 void reset();
 void test_info(const std::string &s);
 void run_test(const std::string &name, std::function<void()> f);
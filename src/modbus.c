@@ -11,6 +11,8 @@
 
 static int8_t mb_timer_ref;
 static mb_slave_ctx_t mb_slave_ctx;
+static ModbusSlaveFunctionHandler mb_functions[MODBUS_FUNC_MAX];
+static uint8_t mb_func_index[256];
 
 #define MB_TIMER_IS_RUNNING() (R8_TMR0_CTRL_MOD & RB_TMR_COUNT_EN)
 #define MB_TIMER_STOP()	TMR0_Disable()
@@ -36,10 +38,37 @@ static void modbus_timer_disable(){
 		TMR0_Disable();
 	}
 }
+/**
+ * @brief Move bytes of the pending response into the TX FIFO until it's full
+ */
+__HIGH_CODE
+static void modbus_tx_fill(){
+	while (mb_slave_ctx.tx_pos < mb_slave_ctx.tx_len && 
+		R8_UART2_TFC < UART_FIFO_SIZE)
+	{
+		UART2_SendByte(mb_slave_ctx.tx_buf[mb_slave_ctx.tx_pos]);
+		mb_slave_ctx.tx_pos ++;
+	}
+}
+
+/**
+ * @brief Send what is left of the pending response by polling, wait until the 
+ * last byte is out. Works with interrupts disabled.
+ */
+static void modbus_tx_flush(){
+	UART2_INTCfg(DISABLE, RB_IER_THR_EMPTY);
+	while (mb_slave_ctx.tx_pos < mb_slave_ctx.tx_len){
+		modbus_tx_fill();
+	}
+	mb_slave_ctx.tx_len = 0;
+	while (!(R8_UART2_LSR & RB_LSR_TX_ALL_EMP));
+}
+
 static void modbus_slave_set_idle(){
 	mb_slave_ctx.flag_frame_err = 0;
 	mb_slave_ctx.tcnt = 0;
 	mb_slave_ctx.req_len = 0;
+	mb_slave_ctx.req_crc = MODBUS_CRC_INIT;
 	mb_slave_ctx.status = MODBUS_S_IDLE;
 }
 
@@ -98,14 +127,8 @@ static void modbus_timer_init(){
 	TMR0_Disable();
 }
 
-void slave_recv(uint8_t d){
-	int framelen, stoped;
-	stoped = 0;
-	if (MB_TIMER_IS_RUNNING()){
-		MB_TIMER_STOP();
-		stoped = 1;
-	}
-	framelen = sizeof(mb_slave_ctx.req_buf);
+static void slave_recv_byte(uint8_t d){
+	int framelen = sizeof(mb_slave_ctx.req_buf);
 	switch(mb_slave_ctx.status){
 		case MODBUS_S_INIT:
 		case MODBUS_S_IDLE:
@@ -113,12 +136,14 @@ void slave_recv(uint8_t d){
 			mb_slave_ctx.status = MODBUS_S_RECV;
 			mb_slave_ctx.req_buf[mb_slave_ctx.req_len] = d;
 			mb_slave_ctx.req_len ++;
+			mb_slave_ctx.req_crc = modbusCRCByte(MODBUS_CRC_INIT, d);
 			break;
 		case MODBUS_S_RECV:
 			mb_slave_ctx.tcnt = 0;
 			if (mb_slave_ctx.req_len < framelen){
 				mb_slave_ctx.req_buf[mb_slave_ctx.req_len] = d;
 				mb_slave_ctx.req_len ++;
+				mb_slave_ctx.req_crc = modbusCRCByte(mb_slave_ctx.req_crc, d);
 			}
 			break;
 		case MODBUS_S_CTRL_AND_WAITING:
@@ -128,15 +153,52 @@ void slave_recv(uint8_t d){
 		default:
 			break;
 	}
-out:
+}
+
+#if MODBUS_RX_TRIG_BYTES > 1
+/**
+ * @brief Take bytes from the RX FIFO, leaving "keep" of them there so that 
+ * the receive timeout still fires
+ */
+static void slave_recv_fifo(uint8_t keep){
+	while (R8_UART2_RFC > keep){
+		slave_recv_byte(UART2_RecvByte());
+	}
+}
+
+/**
+ * @brief The line has been idle for MODBUS_RX_TOUT_CHARS, finish the frame or 
+ * let TMR0 wait for the rest of T3.5
+ */
+static void slave_recv_timeout(){
+	slave_recv_fifo(0);
+	if (MODBUS_S_RECV != mb_slave_ctx.status){
+		return;
+	}
+	mb_slave_ctx.tcnt = mb_slave_ctx.rx_tout_ticks;
+	if (mb_slave_ctx.tcnt >= 7){
+		mb_slave_ctx.status = MODBUS_S_RECV_FINISH;
+	}else{
+		mb_slave_ctx.status = MODBUS_S_CTRL_AND_WAITING;
+		modbus_timer_enable();
+	}
+}
+#else
+void slave_recv(uint8_t d){
+	int stoped = 0;
+	if (MB_TIMER_IS_RUNNING()){
+		MB_TIMER_STOP();
+		stoped = 1;
+	}
+	slave_recv_byte(d);
 	if (stoped){
 		MB_TIMER_RESUME();
-
 	}
 	if (1 == mb_slave_ctx.req_len){
 		modbus_timer_enable();
 	}
 }
+#endif
 
 ModbusError register_callback( const ModbusSlave *status, 
 	const ModbusRegisterCallbackArgs *args,
@@ -199,6 +261,15 @@ void UART2_IRQHandler(void)
             break;
         }
 
+#if MODBUS_RX_TRIG_BYTES > 1
+        case UART_II_RECV_RDY: // 数据达到设置触发点
+            slave_recv_fifo(1);
+            break;
+
+        case UART_II_RECV_TOUT: // 接收超时，暂时一帧数据接收完成
+            slave_recv_timeout();
+            break;
+#else
         case UART_II_RECV_RDY: // 数据达到设置触发点
             while(R8_UART2_RFC)
             {
@@ -212,8 +283,19 @@ void UART2_IRQHandler(void)
                 slave_recv(UART2_RecvByte());
             }
             break;
+#endif
 
         case UART_II_THR_EMPTY: // 发送缓存区空，可继续发送
+            if (mb_slave_ctx.tx_pos < mb_slave_ctx.tx_len)
+            {
+                modbus_tx_fill();
+            }
+            else
+            {
+                // FIFO drained, response sent
+                UART2_INTCfg(DISABLE, RB_IER_THR_EMPTY);
+                mb_slave_ctx.tx_len = 0;
+            }
             break;
 
         case UART_II_MODEM_CHG: // 只支持串口0
@@ -230,16 +312,35 @@ int modbus_slave_uart_init(mb_slave_ctx_t *slave_ctx){
 	GPIOA_SetBits(GPIO_Pin_7);
 	UART2_DefInit();
 	UART2_BaudRateCfg(slave_ctx->baudrate);
+#if MODBUS_RX_TRIG_BYTES >= 7
+	UART2_ByteTrigCfg(UART_7BYTE_TRIG);
+#elif MODBUS_RX_TRIG_BYTES >= 4
+	UART2_ByteTrigCfg(UART_4BYTE_TRIG);
+#elif MODBUS_RX_TRIG_BYTES >= 2
+	UART2_ByteTrigCfg(UART_2BYTE_TRIG);
+#else
 	UART2_ByteTrigCfg(UART_1BYTE_TRIG);
+#endif
+	// 11 bits per char, in units of the T0.5 timer tick
+	slave_ctx->rx_tout_ticks = GetSysClock() / slave_ctx->baudrate * 
+		MODBUS_RX_TOUT_CHARS * 11 / modbus_t05_cnt(slave_ctx->baudrate);
 	UART2_INTCfg(ENABLE, RB_IER_RECV_RDY | RB_IER_LINE_STAT);
 	PFIC_EnableIRQ(UART2_IRQn);
 	return 0;
 }
+/**
+ * @brief Start sending "buf", the rest is fed from the THR empty interrupt. 
+ * "buf" must stay untouched until modbus_is_sending() returns 0.
+ */
 int modbus_uart_send(uint8_t *buf, int len){
-	if (!buf || len <= 0){
+	if (!buf || len <= 0 || modbus_is_sending()){
 		return -1;
 	}
-	UART2_SendString(buf, len);
+	mb_slave_ctx.tx_buf = buf;
+	mb_slave_ctx.tx_pos = 0;
+	mb_slave_ctx.tx_len = len;
+	modbus_tx_fill();
+	UART2_INTCfg(ENABLE, RB_IER_THR_EMPTY);
 	return 0;
 }
 
@@ -255,13 +356,18 @@ int modbus_slave_init(mb_callback_t *callback){
 	if(callback){
 		memcpy(&mb_slave_ctx.callback, callback, sizeof(mb_callback_t));
 	}
+	memcpy(mb_functions, modbusSlaveDefaultFunctions, 
+		MIN(modbusSlaveDefaultFunctionCount, MODBUS_FUNC_MAX) * 
+		sizeof(ModbusSlaveFunctionHandler));
 	ModbusErrorInfo err = modbusSlaveInit(&mb_slave_ctx.slave, 
 		register_callback, NULL, modbus_slave_allocator, 
-		modbusSlaveDefaultFunctions, modbusSlaveDefaultFunctionCount);
+		mb_functions, MIN(modbusSlaveDefaultFunctionCount, MODBUS_FUNC_MAX));
 	if (!modbusIsOk(err)){
 		return -1;
 	}
 	modbusSlaveSetUserPointer(&mb_slave_ctx.slave, &mb_slave_ctx);
+	modbus_regs_attach(&mb_slave_ctx.slave);
+	modbusSlaveBuildFunctionIndex(&mb_slave_ctx.slave, mb_func_index);
 	modbus_slave_uart_init(&mb_slave_ctx);
 	return 0;
 }
@@ -275,7 +381,26 @@ void modbus_init(mb_callback_t *callback){
 	modbus_timer_init();
 }
 
+/**
+ * @brief Add a handler for function "id", call after modbus_init
+ * @return 0 on success, -1 if there is no room for it
+ */
+int modbus_add_function(uint8_t id, ModbusRequestParsingFunction handler){
+	ModbusSlave *slave = &mb_slave_ctx.slave;
+	if (!handler || slave->functionCount >= MODBUS_FUNC_MAX){
+		LOG_ERROR(TAG, "no room for function %u", id);
+		return -1;
+	}
+	mb_functions[slave->functionCount].id = id;
+	mb_functions[slave->functionCount].ptr = handler;
+	slave->functionCount ++;
+	modbusSlaveBuildFunctionIndex(slave, mb_func_index);
+	return 0;
+}
+
 void modbus_deinit(){
+	// let the last response out before reset or jumping to app
+	modbus_tx_flush();
 	UART2_INTCfg(DISABLE, RB_IER_RECV_RDY | RB_IER_LINE_STAT);
 	MB_TIMER_STOP();
 	modbusSlaveDestroy(&mb_slave_ctx.slave);
@@ -288,11 +413,14 @@ uint32_t modbus_lasttime_recv(){
 
 void modbus_frame_check(){
 	ModbusErrorInfo err;
-	if (MODBUS_S_RECV_FINISH == mb_slave_ctx.status){
+	// resp_buf is still being sent, hold the request until it's out
+	if (MODBUS_S_RECV_FINISH == mb_slave_ctx.status && !modbus_is_sending()){
 		mb_slave_ctx.lasttime_recv = worktime_get()/1000;
 		if (!mb_slave_ctx.flag_frame_err){
-			err = modbusParseRequestRTU( &mb_slave_ctx.slave, 
-				mb_slave_ctx.address, mb_slave_ctx.req_buf, mb_slave_ctx.req_len);
+			// CRC was accumulated as the bytes arrived
+			err = modbusParseRequestRTUWithCRC(&mb_slave_ctx.slave, 
+				mb_slave_ctx.address, mb_slave_ctx.req_buf, mb_slave_ctx.req_len, 
+				mb_slave_ctx.req_crc);
 			if (MODBUS_OK != modbusGetErrorCode(err)){
 				PRINT("modbus parse err(%02x)", modbusGetErrorCode(err));
 			}
@@ -312,3 +440,7 @@ void modbus_frame_check(){
 int modbus_is_receiving(){
 	return MODBUS_S_RECV == mb_slave_ctx.status;
 }
+
+int modbus_is_sending(){
+	return mb_slave_ctx.tx_len > 0;
+}
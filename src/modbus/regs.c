@@ -140,6 +140,44 @@ ModbusError modbus_reg_callback(void *ctx,
 	return 0;
 }
 
+static ModbusError modbus_reg_map_before_write(const ModbusSlave *slave, 
+	uint16_t index, uint16_t value)
+{
+	mb_slave_ctx_t *sctx = modbusSlaveGetUserPointer(slave);
+	if (sctx && sctx->callback.before_reg_write && 
+		sctx->callback.before_reg_write(index, value))
+	{
+		return MODBUS_ERROR_OTHER;
+	}
+	return MODBUS_OK;
+}
+
+static ModbusError modbus_reg_map_after_write(const ModbusSlave *slave, 
+	uint16_t index, uint16_t value)
+{
+	mb_slave_ctx_t *sctx = modbusSlaveGetUserPointer(slave);
+	if (sctx && sctx->callback.after_reg_write){
+		sctx->callback.after_reg_write(index, value);
+	}
+	return MODBUS_OK;
+}
+
+/**
+ * Registers lightmodbus reads and writes in place, sorted by address
+ */
+static const ModbusRegisterMapEntry mb_reg_map[] = {
+	{MODBUS_HOLDING_REGISTER, MB_REG_ADDR_RO_BASE, 
+		MB_REG_ADDR_RO_MAX - MB_REG_ADDR_RO_BASE, mb_ro_regs, 0, NULL, NULL},
+	{MODBUS_HOLDING_REGISTER, MB_REG_ADDR_CONFIG_BASE, 
+		MB_REG_ADDR_CONFIG_MAX - MB_REG_ADDR_CONFIG_BASE, mb_config_regs, 1, 
+		modbus_reg_map_before_write, modbus_reg_map_after_write},
+};
+
+void modbus_regs_attach(ModbusSlave *slave){
+	modbusSlaveSetRegisterMap(slave, mb_reg_map, 
+		sizeof(mb_reg_map) / sizeof(mb_reg_map[0]));
+}
+
 void modbus_reg_update_uid(const uint8_t *uid, uint16_t len){
 	uint8_t *buf = (uint8_t *)(mb_ro_regs + MB_REG_ADDR_UID_7);
 	uint16_t maxlen = (MB_REG_ADDR_UID_0 - MB_REG_ADDR_UID_7 + 1) * 2;
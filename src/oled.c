@@ -1,6 +1,7 @@
 #include "oled.h"
 #include "stdlib.h"
 #include "stdint.h"
+#include "string.h"
 #include "oledfont.h"  	 
 #include "CH58x_common.h"
 
@@ -15,9 +16,37 @@
 //[6]0 1 2 3 ... 127	
 //[7]0 1 2 3 ... 127 
 
-//OLED_GRAM[X][Y]
-static uint8_t OLED_GRAM[144][8];
+//OLED_GRAM[page][x]，每页一行连续存放，可直接DMA发送
+static uint8_t OLED_GRAM[OLED_PAGE_MAX][OLED_X_MAX] __attribute__((aligned(4)));
 static uint8_t flag_refresh = 0;
+#if OLED_USE_SPI0
+//DMA起始地址需要四字节对齐，发送起始列向下对齐
+#define OLED_DMA_ALIGN	4
+static volatile uint8_t oled_dma_busy = 0;
+#else
+#define OLED_DMA_ALIGN	1
+#endif
+
+//每页需要更新的列范围[dirty_s, dirty_e)，dirty_s >= dirty_e 表示无需更新
+static uint8_t dirty_s[OLED_PAGE_MAX];
+static uint8_t dirty_e[OLED_PAGE_MAX];
+
+//标记第page页的[x_s, x_e)列需要更新
+static void OLED_MarkDirty(uint8_t page, uint8_t x_s, uint8_t x_e)
+{
+	if (dirty_s[page] >= dirty_e[page]){
+		dirty_s[page] = x_s;
+		dirty_e[page] = x_e;
+	}else{
+		if (x_s < dirty_s[page]){
+			dirty_s[page] = x_s;
+		}
+		if (x_e > dirty_e[page]){
+			dirty_e[page] = x_e;
+		}
+	}
+	flag_refresh = 1;
+}
 //反显函数
 void OLED_ColorTurn(uint8_t i)
 {
@@ -44,6 +73,50 @@ void OLED_DisplayTurn(uint8_t i)
 	}
 }
 
+//DMA发送是否未完成，完成后释放CS
+static int OLED_Busy(void)
+{
+#if OLED_USE_SPI0
+	if (oled_dma_busy && (R8_SPI0_INT_FLAG & RB_SPI_IF_CNT_END)){
+		R8_SPI0_CTRL_CFG &= ~RB_SPI_DMA_ENABLE;
+		OLED_CS_Set();
+		oled_dma_busy = 0;
+	}
+	return oled_dma_busy;
+#else
+	return 0;
+#endif
+}
+
+#if OLED_USE_SPI0
+void OLED_WR_Byte(uint8_t dat,uint8_t cmd)
+{
+	while (OLED_Busy());
+	if(cmd){
+	  OLED_DC_Set();
+	}else {
+	  OLED_DC_Clr();
+	}
+	OLED_CS_Clr();
+	SPI0_MasterSendByte(dat);
+	OLED_CS_Set();
+	OLED_DC_Set();
+}
+
+//直接从显存DMA发送第page页[x_s, x_e)列，不等待发送完成
+static void OLED_WR_Page(uint8_t page, uint8_t x_s, uint8_t x_e)
+{
+	OLED_DC_Set();
+	OLED_CS_Clr();
+	R8_SPI0_CTRL_MOD &= ~RB_SPI_FIFO_DIR;
+	R16_SPI0_DMA_BEG = (uint32_t)&OLED_GRAM[page][x_s];
+	R16_SPI0_DMA_END = (uint32_t)&OLED_GRAM[page][x_e];
+	R16_SPI0_TOTAL_CNT = x_e - x_s;
+	R8_SPI0_INT_FLAG = RB_SPI_IF_CNT_END | RB_SPI_IF_DMA_END;
+	oled_dma_busy = 1;
+	R8_SPI0_CTRL_CFG |= RB_SPI_DMA_ENABLE;
+}
+#else
 void OLED_WR_Byte(uint8_t dat,uint8_t cmd)
 {	
 	uint8_t i;			  
@@ -68,6 +141,16 @@ void OLED_WR_Byte(uint8_t dat,uint8_t cmd)
 	OLED_DC_Set();   	  
 }
 
+//发送第page页[x_s, x_e)列的显存
+static void OLED_WR_Page(uint8_t page, uint8_t x_s, uint8_t x_e)
+{
+	uint8_t n;
+	for(n = x_s; n < x_e; n++){
+		OLED_WR_Byte(OLED_GRAM[page][n], OLED_DATA);
+	}
+}
+#endif
+
 //开启OLED显示 
 void OLED_DisPlay_On(void)
 {
@@ -84,45 +167,57 @@ void OLED_DisPlay_Off(void)
 	OLED_WR_Byte(0xAE,OLED_CMD);//关闭屏幕
 }
 
-//更新显存到OLED	
+//更新显存到OLED，只发送各页中有改动的列
+//DMA发送时不等待，上一页未发完就返回，剩下的页下次调用时发送
 void OLED_Refresh(void)
 {
-	uint8_t i,n;
+	uint8_t i, x_s;
 	if (!flag_refresh){
 		return;
 	}
-	for(i = 0; i < 8; i++)
+	for(i = 0; i < OLED_PAGE_MAX; i++)
 	{
-	   OLED_WR_Byte(0xb0 + i,OLED_CMD); //设置行起始地址
-	   OLED_WR_Byte(0x00, OLED_CMD);   //设置低列起始地址
-	   OLED_WR_Byte(0x10, OLED_CMD);   //设置高列起始地址
-	   for(n = 0; n < 128; n++){
-		 OLED_WR_Byte(OLED_GRAM[n][i], OLED_DATA);
-	   }
-  	}
+		if (dirty_s[i] >= dirty_e[i]){
+			continue;
+		}
+		if (OLED_Busy()){
+			return;
+		}
+		x_s = dirty_s[i] & ~(OLED_DMA_ALIGN - 1);
+		OLED_WR_Byte(0xb0 + i,OLED_CMD); //设置行起始地址
+		OLED_WR_Byte(0x00 | (x_s & 0x0f), OLED_CMD);   //设置低列起始地址
+		OLED_WR_Byte(0x10 | (x_s >> 4), OLED_CMD);   //设置高列起始地址
+		OLED_WR_Page(i, x_s, dirty_e[i]);
+		dirty_s[i] = dirty_e[i] = 0;
+	}
 	flag_refresh = 0;
 }
+
+//更新显存到OLED，等待全部发送完成
+void OLED_Flush(void)
+{
+	do{
+		OLED_Refresh();
+	}while(flag_refresh || OLED_Busy());
+}
 //清屏函数
 void OLED_Clear(void)
 {
-	uint8_t i,n;
-	for(i = 0; i < 8; i++)
+	uint8_t i;
+	memset(OLED_GRAM, 0, sizeof(OLED_GRAM));//清除所有数据
+	for(i = 0; i < OLED_PAGE_MAX; i++)
 	{
-	   	for(n = 0;n < 128; n++)
-		{
-			OLED_GRAM[n][i]=0;//清除所有数据
-		}
+		OLED_MarkDirty(i, 0, OLED_X_MAX);
 	}
-	flag_refresh = 1;
-	OLED_Refresh();//更新显示
+	OLED_Flush();//更新显示
 }
 
+//清除显存中的一块区域，整页按行清零，首尾不满一页的按位清除
 void OLED_clear_buffer(oled_area_t *area)
 {
-	uint8_t i,n;
+	uint8_t i, n;
 	uint8_t mask = 0;
-	uint8_t idx_y_s, idx_y_e;
-	uint8_t bit_s, bit_e;
+	uint8_t page_s, page_e;
 
 	if (0 == area->width || 0 == area->height){
 		return ;
@@ -134,29 +229,30 @@ void OLED_clear_buffer(oled_area_t *area)
 		return ;
 	}
 	
-	idx_y_s = area->y / 8;
-	bit_s = area->y % 8;
-	
-	idx_y_e = (area->y + area->height) / 8;
-	bit_e = (area->y + area->height) % 8;
+	page_s = area->y / 8;
+	page_e = (area->y + area->height - 1) / 8;
 	
 	//Y
-	for(i = idx_y_s; i < idx_y_e; i++)
+	for(i = page_s; i <= page_e; i++)
 	{
-		mask = 0;
-		if (i == idx_y_s){
-			mask |= ~(0xff << bit_s);
+		mask = 0xff;//需要清除的位
+		if (i == page_s){
+			mask &= 0xff << (area->y % 8);
 		}
-		if (i == idx_y_e){
-			mask |= 0xff << (bit_e + 1);
+		if (i == page_e){
+			mask &= 0xff >> (7 - (area->y + area->height - 1) % 8);
 		}
 		//X
-	   	for(n = area->x; n < area->x + area->width; n++)
-		{
-			OLED_GRAM[n][i] &= mask;//清除数据
+		if (mask == 0xff){
+			memset(&OLED_GRAM[i][area->x], 0, area->width);
+		}else{
+			for(n = area->x; n < area->x + area->width; n++)
+			{
+				OLED_GRAM[i][n] &= ~mask;//清除数据
+			}
 		}
+		OLED_MarkDirty(i, area->x, area->x + area->width);
 	}
-	flag_refresh = 1;
 }
 
 //画点 
@@ -165,21 +261,62 @@ void OLED_clear_buffer(oled_area_t *area)
 //t:1 填充 0,清空	
 void OLED_DrawPoint(uint8_t x, uint8_t y, uint8_t t)
 {
-	uint8_t i, m, n;
+	uint8_t i, m, n, old;
 	if (x > 127 || y > 63){
 		return ;
 	}
 	i = y / 8;
 	m = y % 8;
 	n = 1 << m;
+	old = OLED_GRAM[i][x];
 	if(t){
-		OLED_GRAM[x][i] |= n;
+		OLED_GRAM[i][x] |= n;
 	}else{
-		OLED_GRAM[x][i] =~ OLED_GRAM[x][i];
-		OLED_GRAM[x][i] |= n;
-		OLED_GRAM[x][i] =~ OLED_GRAM[x][i];
+		OLED_GRAM[i][x] &= ~n;
+	}
+	//重绘相同内容时不需要更新
+	if (OLED_GRAM[i][x] != old){
+		OLED_MarkDirty(i, x, x + 1);
+	}
+}
+
+//按字节写入第page页x列开始的len列显存，只标记有变化的列
+void OLED_BlitPage(uint8_t page, uint8_t x, const uint8_t *data, uint8_t len)
+{
+	uint8_t i, x_s = OLED_X_MAX, x_e = 0;
+	uint8_t *row;
+	if (page >= OLED_PAGE_MAX || x >= OLED_X_MAX){
+		return ;
+	}
+	if (len > OLED_X_MAX - x){
+		len = OLED_X_MAX - x;
+	}
+	row = &OLED_GRAM[page][x];
+	for(i = 0; i < len; i++){
+		if (row[i] != data[i]){
+			row[i] = data[i];
+			if (x_s == OLED_X_MAX){
+				x_s = x + i;
+			}
+			x_e = x + i + 1;
+		}
+	}
+	if (x_e){
+		OLED_MarkDirty(page, x_s, x_e);
+	}
+}
+
+//把src页开始的n页显存整页移到dst页，用于按页对齐的滚动
+void OLED_MovePages(uint8_t dst, uint8_t src, uint8_t n)
+{
+	uint8_t i;
+	if (dst == src || !n || dst + n > OLED_PAGE_MAX || src + n > OLED_PAGE_MAX){
+		return ;
+	}
+	memmove(OLED_GRAM[dst], OLED_GRAM[src], n * OLED_X_MAX);
+	for(i = 0; i < n; i++){
+		OLED_MarkDirty(dst + i, 0, OLED_X_MAX);
 	}
-	flag_refresh = 1;
 }
 
 //画线
@@ -307,6 +444,39 @@ void OLED_ShowChar(uint8_t x,uint8_t y,uint8_t chr,uint8_t size1,uint8_t mode)
 }
 
 
+//在第page页x列显示一个字符，字模按整字节直接写入显存，只支持正常显示
+//x:0~127
+//page:0~7
+//size1:选择字体 6x8/6x12/8x16/12x24
+void OLED_ShowCharPage(uint8_t x, uint8_t page, uint8_t chr, uint8_t size1)
+{
+	const uint8_t *glyph;
+	uint8_t i, width;
+	if (chr < ' ' || chr > '~'){
+		chr = ' ';
+	}
+	chr -= ' ';
+	if(size1 == 8){
+		glyph = asc2_0806[chr];
+		width = 6;
+	}else if(size1 == 12){
+		glyph = asc2_1206[chr];
+		width = 6;
+	}else if(size1 == 16){
+		glyph = asc2_1608[chr];
+		width = 8;
+	}else if(size1 == 24){
+		glyph = asc2_2412[chr];
+		width = 12;
+	}else{
+		return;
+	}
+	//字模按页存放，每页width字节
+	for(i = 0; i < (size1 + 7) / 8; i++){
+		OLED_BlitPage(page + i, x, glyph + i * width, width);
+	}
+}
+
 //显示字符串
 //x,y:起点坐标  
 //size1:字体大小 
@@ -446,36 +616,52 @@ void OLED_ShowNum(uint8_t x, uint8_t y, uint32_t num, uint8_t len,
 //	}
 //}
 
+//按mask把val合并到第page页x列，返回内容是否变化
+static uint8_t OLED_MergeByte(uint8_t page, uint8_t x, uint8_t val, uint8_t mask)
+{
+	uint8_t old = OLED_GRAM[page][x];
+	OLED_GRAM[page][x] = (old & ~mask) | (val & mask);
+	return OLED_GRAM[page][x] != old;
+}
+
 //x,y：起点坐标
 //sizex,sizey,图片长宽
-//BMP[]：要写入的图片数组
+//BMP[]：要写入的图片数组，按页存放
 //mode:0,反色显示;1,正常显示
+//y按页对齐且正常显示时整行写入，否则每字节拆到相邻两页
 void OLED_ShowPicture(uint8_t x, uint8_t y, uint8_t sizex, uint8_t sizey, 
 	uint8_t BMP[],uint8_t mode)
 {
-	uint16_t j = 0;
-	uint8_t i, n, temp, m;
-	uint8_t x0 = x, y0 = y;
+	uint8_t i, n, temp, page, shift, width;
+	uint8_t changed_lo, changed_hi;
+	const uint8_t *src;
+	if (x >= OLED_X_MAX || y >= OLED_Y_MAX){
+		return ;
+	}
+	width = sizex < OLED_X_MAX - x ? sizex : OLED_X_MAX - x;
 	sizey = sizey / 8 + ((sizey % 8) ? 1 : 0);
-	for(n = 0; n < sizey; n++){
-		for(i = 0; i < sizex; i++){
-			temp = BMP[j];
-			j++;
-			for(m = 0; m < 8; m++){
-				if(temp & 0x01){
-					OLED_DrawPoint(x, y, mode);
-				}else{
-					OLED_DrawPoint(x, y, !mode);
-				}
-				temp >>= 1;
-				y++;
-			}
-			x++;
-			if((x - x0) == sizex){
-				x = x0;
-				y0 = y0 + 8;
+	page = y / 8;
+	shift = y % 8;
+	for(n = 0; n < sizey && page + n < OLED_PAGE_MAX; n++){
+		src = BMP + (uint16_t)n * sizex;
+		if (!shift && mode){
+			OLED_BlitPage(page + n, x, src, width);
+			continue;
+		}
+		changed_lo = changed_hi = 0;
+		for(i = 0; i < width; i++){
+			temp = mode ? src[i] : ~src[i];
+			changed_lo |= OLED_MergeByte(page + n, x + i, temp << shift, 0xff << shift);
+			if (shift && page + n + 1 < OLED_PAGE_MAX){
+				changed_hi |= OLED_MergeByte(page + n + 1, x + i, 
+					temp >> (8 - shift), 0xff >> (8 - shift));
 			}
-			y = y0;
+		}
+		if (changed_lo){
+			OLED_MarkDirty(page + n, x, x + width);
+		}
+		if (changed_hi){
+			OLED_MarkDirty(page + n + 1, x, x + width);
 		}
 	}
 }
@@ -487,6 +673,10 @@ void OLED_io_init(){
 	OLED_RES_INIT();
 	OLED_CS_INIT();
 	OLED_DC_INIT();
+#if OLED_USE_SPI0
+	SPI0_MasterDefInit();
+	SPI0_CLKCfg(OLED_SPI0_CLK_DIV);
+#endif
 }
 
 void OLED_Init(void)
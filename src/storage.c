@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include "CH58x_common.h"
 #include "storage.h"
 #include "utils.h"
@@ -14,20 +15,44 @@ typedef struct st_item_location{
 	uint16_t offset;
 }st_item_location_t;
 
-typedef struct st_search_context {
+/**
+ * Index entry, maps an item idx to the location of its latest record.
+ */
+typedef struct st_index_entry{
 	uint16_t item_idx;
-	st_item_header_t last_header;
-	st_item_location_t last_location;
-} st_search_ctx_t;
+	uint8_t len;
+	st_item_location_t location;
+} st_index_entry_t;
+
+/**
+ * A batch is written as one record(idx ST_ITEM_IDX_BATCH) whose content is 
+ * this header followed by the records of its items. Like any record its 
+ * length byte is programmed last, which commits all items at once. Crc of the 
+ * record covers this header only.
+ */
+typedef struct st_batch_header{
+	uint8_t item_cnt;
+	uint8_t reserved;
+} st_batch_header_t;
+#define ST_BATCH_RECORD_SIZE	(sizeof(st_item_header_t) + sizeof(st_batch_header_t))
+// pages reclaiming less are only compacted when the log runs out of space
+#define ST_GC_GARBAGE_MIN	(ST_PAGE_CONTENT_MAX / 4)
 
 typedef struct st_context {
 	uint8_t flag_init;
+	uint8_t flag_index_overflow;
+	uint8_t flag_wear_check;	//a page was erased since the last wear check
 	uint16_t page_erased;
 	uint16_t page_active;
+	uint16_t page_last;	//page that was active most recently
 	uint16_t page_start;
 	uint16_t page_cnt;
+	uint32_t erase_max;
+	uint16_t gc_page;	//page being compacted, ST_PAGE_MAX if none
+	uint16_t gc_offset;	//next record to move in gc_page
 	st_page_t pages[ST_PAGE_MAX];
-	st_search_ctx_t search_ctx;
+	uint16_t index_cnt;
+	st_index_entry_t index[ST_INDEX_MAX];	//sorted by item_idx
 } st_ctx_t;
 static st_ctx_t st_ctx;
 
@@ -45,11 +70,96 @@ static const char *st_page_status_str(uint8_t status){
 			return "FULL";
 		case ST_PAGE_S_UNAVAILABLE:
 			return "UNAVAIABLE";
+		case ST_PAGE_S_OLD_ACTIVE:
+		case ST_PAGE_S_OLD_FULL:
+			return "OLD";
 		default:
 			return "UNKNOWN";
 	}
 }
 
+static st_index_entry_t *st_index_find(st_ctx_t *ctx, uint16_t item_idx, 
+	uint16_t *pos)
+{
+	uint16_t low = 0;
+	uint16_t high = ctx->index_cnt;
+	uint16_t mid = 0;
+	while(low < high){
+		mid = (low + high) / 2;
+		if (ctx->index[mid].item_idx == item_idx){
+			low = mid;
+			break;
+		}
+		if (ctx->index[mid].item_idx < item_idx){
+			low = mid + 1;
+		}else{
+			high = mid;
+		}
+	}
+	if (pos){
+		*pos = low;
+	}
+	if (low < ctx->index_cnt && ctx->index[low].item_idx == item_idx){
+		return &ctx->index[low];
+	}
+	return NULL;
+}
+
+/**
+ * @brief insert or update index entry of an item
+ * @return 0-success, (-1)-index is full, item is not indexed
+ */
+static int st_index_update(st_ctx_t *ctx, uint16_t item_idx, uint8_t len, 
+	uint16_t page, uint16_t offset)
+{
+	st_index_entry_t *entry = NULL;
+	uint16_t pos = 0;
+	entry = st_index_find(ctx, item_idx, &pos);
+	if (!entry){
+		if (ctx->index_cnt >= ST_INDEX_MAX){
+			if (!ctx->flag_index_overflow){
+				LOG_ERROR(TAG, "index full, fall back to page scan");
+			}
+			ctx->flag_index_overflow = 1;
+			return -1;
+		}
+		memmove(&ctx->index[pos + 1], &ctx->index[pos], 
+			(ctx->index_cnt - pos) * sizeof(st_index_entry_t));
+		ctx->index_cnt ++;
+		entry = &ctx->index[pos];
+		entry->item_idx = item_idx;
+	}
+	entry->len = len;
+	entry->location.page = page;
+	entry->location.offset = offset;
+	return 0;
+}
+
+static void st_index_remove(st_ctx_t *ctx, uint16_t item_idx){
+	uint16_t pos = 0;
+	if (!st_index_find(ctx, item_idx, &pos)){
+		return;
+	}
+	ctx->index_cnt --;
+	memmove(&ctx->index[pos], &ctx->index[pos + 1], 
+		(ctx->index_cnt - pos) * sizeof(st_index_entry_t));
+}
+
+static void st_index_remove_page(st_ctx_t *ctx, uint16_t page){
+	uint16_t i = 0;
+	uint16_t cnt = 0;
+	for (i = 0; i < ctx->index_cnt; i++){
+		if (ctx->index[i].location.page == page){
+			continue;
+		}
+		if (cnt != i){
+			memcpy(&ctx->index[cnt], &ctx->index[i], sizeof(st_index_entry_t));
+		}
+		cnt ++;
+	}
+	ctx->index_cnt = cnt;
+}
+
 static int st_page_write(uint16_t idx, uint16_t offset, 
 	uint8_t *buf, uint16_t len)
 {
@@ -59,7 +169,7 @@ static int st_page_write(uint16_t idx, uint16_t offset,
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
 	}
-	if (offset + len  + ST_PAGE_HEADER_SIZE >= ST_PAGE_SIZE){
+	if (offset + len + ST_PAGE_HEADER_SIZE > ST_PAGE_SIZE){
 		return -1;
 	}
 	while(bytes_remain){
@@ -82,7 +192,7 @@ static int st_page_read(uint16_t idx, uint16_t offset,
 		LOG_ERROR(TAG, "invalid idx.");
 		return -1;
 	}
-	if (offset + len + ST_PAGE_HEADER_SIZE>= ST_PAGE_SIZE){
+	if (offset + len + ST_PAGE_HEADER_SIZE > ST_PAGE_SIZE){
 		LOG_ERROR(TAG, "invalid offset or len.");
 		return -1;
 	}
@@ -92,6 +202,14 @@ static int st_page_read(uint16_t idx, uint16_t offset,
 	}
 	return 0;
 }
+/**
+ * @brief mark the record at "offset" as deleted by clearing its idx
+ */
+static int st_page_invalidate(uint16_t idx, uint16_t offset){
+	uint16_t item_idx = 0;
+	return st_page_write(idx, offset + offsetof(st_item_header_t, idx), 
+		(uint8_t *)&item_idx, sizeof(item_idx));
+}
 static int st_page_get_freesize(st_ctx_t *ctx, uint16_t idx){
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
@@ -108,6 +226,16 @@ static int st_page_get_freesize(st_ctx_t *ctx, uint16_t idx){
 	}
 	return 0;
 }
+static int st_page_erase_cnt_write(uint16_t idx, uint32_t erase_cnt){
+	uint8_t buf[3] = {erase_cnt, erase_cnt >> 8, erase_cnt >> 16};
+	if (EEPROM_WRITE(idx * ST_PAGE_SIZE + offsetof(st_page_header_t, erase_cnt), 
+		buf, sizeof(buf)))
+	{
+		LOG_ERROR(TAG, "EEPROM write err.");
+		return -1;
+	}
+	return 0;
+}
 static int st_page_erase(st_ctx_t *ctx, uint16_t idx){
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
@@ -115,15 +243,29 @@ static int st_page_erase(st_ctx_t *ctx, uint16_t idx){
 	if (ST_PAGE_S_ERASED == ctx->pages[idx].status){
 		return 0;
 	}
-	LOG_DEBUG(TAG, "erase page %d", idx);
+	LOG_DEBUG(TAG, "erase page %d(%u times)", idx, ctx->pages[idx].erase_cnt);
 	if (EEPROM_ERASE(idx * ST_PAGE_SIZE, ST_PAGE_SIZE)){
 		LOG_ERROR(TAG, "EEPROM erase err.");
 		return -1;
 	}
+	// an unknown count is estimated by st_page_init
+	if (ST_ERASE_CNT_UNKNOWN != ctx->pages[idx].erase_cnt){
+		ctx->pages[idx].erase_cnt ++;
+		st_page_erase_cnt_write(idx, ctx->pages[idx].erase_cnt);
+		if (ctx->pages[idx].erase_cnt > ctx->erase_max){
+			ctx->erase_max = ctx->pages[idx].erase_cnt;
+		}
+		ctx->flag_wear_check = 1;
+	}
 	ctx->pages[idx].bytes_used = 0;
+	ctx->pages[idx].bytes_available = 0;
 	ctx->pages[idx].item_cnt = 0;
 	ctx->pages[idx].status = ST_PAGE_S_ERASED;
 	ctx->page_erased ++;
+	if (ctx->gc_page == idx){
+		ctx->gc_page = ST_PAGE_MAX;
+	}
+	st_index_remove_page(ctx, idx);
 	return 0;
 }
 //static int st_page_clear(uint16_t idx, uint16_t offset, 
@@ -171,43 +313,78 @@ static int st_page_status_update(st_ctx_t *ctx, uint16_t idx, uint8_t status){
 			ctx->page_erased --;
 		}
 	}
-	if (ST_PAGE_S_ACTIVE == page->status){
+	if (ST_PAGE_S_ACTIVE == page->status && ctx->page_active == idx){
 		ctx->page_active = ST_PAGE_MAX;
 	}
 	if (ST_PAGE_S_ACTIVE == status){
 		ctx->page_active = idx;
+		ctx->page_last = idx;
 	}
 	page->status = status;
 	return 0;
 }
+/**
+ * @brief check that the page is erased, except for the erase counter
+ * @return (-1)-error, 0-not erased, 1-erased
+ */
 static int st_page_erase_check(uint16_t idx){
-	uint8_t buf[EEPROM_PAGE_SIZE];
+	uint8_t buf[ST_PAGE_SIZE];
 	int i = 0;
-	memset(buf, 0xff, EEPROM_PAGE_SIZE);
-	uint32_t bytes_remain = ST_PAGE_SIZE;
-	uint32_t bytes_verify = 0;
-	uint32_t addr = idx * ST_PAGE_SIZE;
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
 	}
-	while(bytes_remain){
-		bytes_verify = MIN(EEPROM_PAGE_SIZE, bytes_remain);
-		if (EEPROM_READ(addr, buf, bytes_verify)){
-			LOG_ERROR(TAG, "read err.");
-			goto fail;
-		}
-		for (i = 0; i < bytes_verify; i++){
-			if (buf[i] != 0xff){
-				return 0;
-			}
+	if (EEPROM_READ(idx * ST_PAGE_SIZE, buf, ST_PAGE_SIZE)){
+		LOG_ERROR(TAG, "read err.");
+		goto fail;
+	}
+	if (buf[offsetof(st_page_header_t, status)] != 0xff){
+		return 0;
+	}
+	for (i = ST_PAGE_HEADER_SIZE; i < ST_PAGE_SIZE; i++){
+		if (buf[i] != 0xff){
+			return 0;
 		}
-		bytes_remain -= bytes_verify;
 	}
 	return 1;
 	
 fail:
 	return -1;
 }
+/**
+ * @brief A record torn by power loss has its length byte erased but leaves 
+ * programmed bytes behind. Turn them into a deleted record, so that the space 
+ * after it can still be used.
+ * @return (-1)-error, 0-nothing behind "offset", 1-sealed
+ */
+static int st_page_seal(uint16_t idx, uint16_t offset){
+	uint8_t buf[ST_PAGE_CONTENT_MAX];
+	uint16_t len = ST_PAGE_CONTENT_MAX - offset;
+	uint8_t record_len = 0;
+	int end = 0;
+	int i = 0;
+	if (offset + sizeof(st_item_header_t) > ST_PAGE_CONTENT_MAX){
+		return 0;
+	}
+	if (st_page_read(idx, offset, buf, len) < 0){
+		return -1;
+	}
+	for (i = 0; i < len; i++){
+		if (buf[i] != 0xff){
+			end = i + 1;
+		}
+	}
+	if (!end){
+		return 0;
+	}
+	LOG_ERROR(TAG, "seal torn record at page %d, offset:%d", idx, offset);
+	record_len = MAX(end, sizeof(st_item_header_t)) - sizeof(st_item_header_t);
+	if (st_page_invalidate(idx, offset) < 0 || 
+		st_page_write(idx, offset, &record_len, sizeof(record_len)) < 0)
+	{
+		return -1;
+	}
+	return 1;
+}
 static int st_page_status(st_ctx_t *ctx, uint16_t idx){
 	st_page_t *page = NULL;
 	if (!ST_PAGE_VALID(idx)){
@@ -251,30 +428,105 @@ static int st_first_page(st_ctx_t *ctx, uint16_t page_from, uint8_t status){
 	return ST_PAGE_MAX;
 }
 
+static int st_batch_verify(st_item_header_t *header, st_batch_header_t *batch){
+	if (ST_ITEM_IDX_BATCH != header->idx || 
+		header->len < sizeof(st_batch_header_t))
+	{
+		return 0;
+	}
+	return crc_table_check(&crc8_maxim_table, (const uint8_t *)batch, 
+		sizeof(*batch)) == header->crc;
+}
+
+/**
+ * @brief get offset of the record following the one at "offset". Records of a 
+ * valid batch are stepped into, anything else is skipped as a whole.
+ * @return (-1)-error, offset of next record
+ */
+static int st_page_next_record(uint16_t idx, uint16_t offset, 
+	st_item_header_t *header)
+{
+	st_batch_header_t batch = {0};
+	if (ST_ITEM_IDX_BATCH == header->idx && 
+		header->len >= sizeof(st_batch_header_t))
+	{
+		if (st_page_read(idx, offset + sizeof(st_item_header_t), 
+			(uint8_t *)&batch, sizeof(batch)) < 0)
+		{
+			return -1;
+		}
+		if (st_batch_verify(header, &batch)){
+			return offset + ST_BATCH_RECORD_SIZE;
+		}
+	}
+	return offset + header->len + sizeof(st_item_header_t);
+}
+
+/**
+ * @brief activate next erased page, then mark the current active page FULL. 
+ * An ACTIVE page always exists once data is written, it holds the newest 
+ * records, which st_init relies on to drop stale copies.
+ * @return (-1)-error, index of the new active page
+ */
+static int st_page_switch(st_ctx_t *ctx){
+	uint16_t page_old = ctx->page_active;
+	uint16_t page_new = ST_PAGE_MAX;
+	uint16_t page_start = ST_PAGE_VALID(ctx->page_last) ? ctx->page_last : 0;
+	uint16_t i = 0;
+	// take the least worn erased page, searching in circular order from the 
+	// last active one to break ties
+	i = page_start;
+	do{
+		if (ST_PAGE_S_ERASED == ctx->pages[i].status && 
+			(!ST_PAGE_VALID(page_new) || 
+			ctx->pages[i].erase_cnt < ctx->pages[page_new].erase_cnt))
+		{
+			page_new = i;
+		}
+		i = st_page_next(i);
+	}while(i != page_start);
+	if (!ST_PAGE_VALID(page_new)){
+		return -1;
+	}
+	if (st_page_status_update(ctx, page_new, ST_PAGE_S_ACTIVE) < 0){
+		LOG_ERROR(TAG, "fail to upadate status");
+		return -1;
+	}
+	if (ST_PAGE_VALID(page_old) && 
+		st_page_status_update(ctx, page_old, ST_PAGE_S_FULL) < 0)
+	{
+		LOG_ERROR(TAG, "fail to upadate status");
+		return -1;
+	}
+	return page_new;
+}
+
 static int st_item_verify(st_item_t *item){
-	crc_type_t crc_type = CRC8_MAXIM_INIT;
 	uint32_t crc_value = 0;
 	if (!item){
 		return 0;
 	}
-	crc_value = crc_check(&crc_type, (const uint8_t *)item->content, 
+	crc_value = crc_table_check(&crc8_maxim_table, (const uint8_t *)item->content, 
 		item->header.len);
 	return (crc_value == item->header.crc);
 }
 
-static int st_page_write_item(st_ctx_t *ctx, uint16_t idx, st_item_t *item){
+
+/**
+ * @brief append a record to page, page status is updated accordingly. The 
+ * length byte(first byte of "buf") is programmed last, so a record torn by 
+ * power loss is never visible.
+ * @return (-1)-error, (>=0)-offset of the record in page
+ */
+static int st_page_append(st_ctx_t *ctx, uint16_t idx, uint8_t *buf, 
+	uint16_t len)
+{
 	st_page_t *page = NULL;
-	uint8_t page_status = 0;
 	uint16_t offset = 0;
-	int bytes_write = 0;
 	int ret = 0;
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
 	}
-	if (!ST_ITEM_IDX_VALID(item->header.idx)){
-		LOG_ERROR(TAG, "invalid item idx.");
-		return -1;
-	}
 	page = &ctx->pages[idx];
 	switch(page->status){
 		case ST_PAGE_S_FULL:
@@ -287,199 +539,60 @@ static int st_page_write_item(st_ctx_t *ctx, uint16_t idx, st_item_t *item){
 			LOG_ERROR(TAG, "invalid page status.");
 			goto fail;
 	}
-	LOG_DEBUG(TAG, "write item(idx:%04X,len:%d,crc:%02X) to page %d, offset:%d", 
-		item->header.idx, item->header.len, item->header.crc, idx, 
-		page->bytes_used);
-	bytes_write = ST_ITEM_SIZE(item);
-	ret = st_page_write(idx, page->bytes_used, (uint8_t *)item, bytes_write);
+	offset = page->bytes_used;
+	ret = st_page_write(idx, offset + 1, buf + 1, len - 1);
+	if (ret >= 0){
+		ret = st_page_write(idx, offset, buf, 1);
+	}
 	if (ret < 0){
-		LOG_ERROR(TAG, "fail to write item.");
+		// the rest of the page may be dirty, stop writing to it. It is sealed 
+		// by next st_init.
+		page->bytes_used = ST_PAGE_CONTENT_MAX;
 		goto fail;
 	}
-	page->bytes_used += bytes_write;
-	page->bytes_available += bytes_write;
-	page_status = page->status;
+	page->bytes_used += len;
+	// a page stays ACTIVE until st_page_switch, even if it is filled up
 	if (ST_PAGE_S_ERASED == page->status){
-		page_status = ST_PAGE_S_ACTIVE;
-	}
-	if (ST_PAGE_CONTENT_MAX - page->bytes_used < sizeof(st_item_header_t)){
-		page_status = ST_PAGE_S_FULL;
-	}
-	if (page_status != page->status){
-		ret = st_page_status_update(ctx, idx, page_status);
+		ret = st_page_status_update(ctx, idx, ST_PAGE_S_ACTIVE);
 		if (ret < 0){
 			LOG_ERROR(TAG, "fail to update page status.");
 			goto fail;
 		}
 	}
-	page->item_cnt ++;
-	return 0;
-fail:
-	return -1;
-}
-
-static int st_page_realign(st_ctx_t *ctx, uint16_t idx){
-	st_page_t *page = NULL;
-	st_item_t item = {0};
-	uint16_t offset = 0;
-	int ret = 0;
-	page = &ctx->pages[idx];
-	uint32_t addr = idx * ST_PAGE_SIZE;
-	uint32_t bytes_read = sizeof(item.header);
-	LOG_DEBUG(TAG, "page %d realign", idx);
-	while(offset < page->bytes_used){
-		ret = st_page_read(idx, offset, (uint8_t *)&item.header, 
-			sizeof(st_item_header_t));
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to read item header.");
-			goto fail;
-		}
-		if (!item.header.crc || !item.header.idx){
-			offset += item.header.len + sizeof(st_item_header_t);
-			continue;
-		}
-		ret = st_page_read(idx, offset + sizeof(st_item_header_t), 
-			item.content, item.header.len);
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to read item content.");
-			goto fail;
-		}
-		if (!st_item_verify(&item)){
-			LOG_ERROR(TAG, "item verify failed.");
-			item.header.idx = 0;
-			st_page_write(idx, offset, (uint8_t *)&item.header, sizeof(st_item_header_t));
-			offset += item.header.len + sizeof(st_item_header_t);
-			if (page->item_cnt){
-				page->item_cnt --;
-			}
-			continue;
-		}
-		if (st_page_get_freesize(ctx, ctx->page_active) < ST_ITEM_SIZE(&item)){
-			uint16_t page_new = st_first_page(ctx, ctx->page_active, ST_PAGE_S_ERASED);
-			if (!ST_PAGE_VALID(page_new)){
-				LOG_ERROR(TAG, "no enougn page.");
-				goto fail;
-			}
-			st_page_status_update(ctx, ctx->page_active, ST_PAGE_S_FULL);
-			st_page_status_update(ctx, page_new, ST_PAGE_S_ACTIVE);
-		}
-		ret = st_page_write_item(ctx, ctx->page_active, &item);
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to write item.");
-			goto fail;
-		}
-		offset += ST_ITEM_SIZE(&item);
-	}
-	ret = st_page_erase(ctx, idx);
-	if (ret < 0){
-		LOG_ERROR(TAG, "erase err.");
-		goto fail;
-	}
-	return 0;
+	return offset;
 fail:
 	return -1;
 }
 
-
-static int st_realign(st_ctx_t *ctx){
-	int i = 0;
-	int ret = 0;
-	uint16_t page_start = ST_PAGE_MAX;
-	uint16_t page_idx = ST_PAGE_MAX;
-	if (!ctx){
-		LOG_ERROR(TAG, "%s:param err", __FUNCTION__);
-		return -1;
-	}
-	page_start = ctx->page_active;
-	if (!ST_PAGE_VALID(page_start)){
-		page_start = 0;
-	}
-	i = page_start;
-	do {
-		if (ST_PAGE_S_FULL == ctx->pages[i].status){
-			if (!ST_PAGE_VALID(page_idx)){
-				page_idx = i;
-			}else{
-				if (ctx->pages[i].item_cnt < ctx->pages[page_idx].item_cnt){
-					page_idx = i;
-				}
-			}
-		}
-		i = st_page_next(i);
-	}while(i != page_start);
-	if (!ST_PAGE_VALID(page_idx)){
-		LOG_DEBUG(TAG, "%s:page not found", __FUNCTION__);
-		return 0;
-	}
-	ret = st_page_realign(ctx, page_idx);
-	if (ret < 0){
-		LOG_ERROR(TAG, "page %d realign failed", page_idx);
-	}
-	return 0;
-}
-
-static int st_page_delete_item(st_ctx_t *ctx, uint16_t idx, uint16_t item_idx)
-{
-	st_page_t *page = NULL;
-	st_item_t item = {0};
-	uint16_t offset = 0;
-	int cnt = 0;
+/**
+ * @brief append item to page
+ * @return (-1)-error, (>=0)-offset of the item in page
+ */
+static int st_page_write_item(st_ctx_t *ctx, uint16_t idx, st_item_t *item){
 	int ret = 0;
 	if (!ST_PAGE_VALID(idx)){
 		return -1;
 	}
-	if (!ST_ITEM_IDX_VALID(item_idx)){
+	if (!ST_ITEM_IDX_VALID(item->header.idx)){
 		LOG_ERROR(TAG, "invalid item idx.");
 		return -1;
 	}
-	page = &ctx->pages[idx];
-	if (ST_PAGE_S_ERASED == page->status || 
-		ST_PAGE_S_UNAVAILABLE == page->status )
-	{
-		return 0;
-	}
-	while(offset < page->bytes_used){
-		ret = st_page_read(idx, offset, (uint8_t *)&item.header, 
-			sizeof(st_item_header_t));
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to read item header.");
-			goto fail;
-		}
-		if (!item.header.idx){
-			offset += item.header.len + sizeof(st_item_header_t);
-			continue;
-		}
-		if (item.header.idx != item_idx){
-			offset += item.header.len + sizeof(st_item_header_t);
-			continue;
-		}
-		LOG_DEBUG(TAG, "delete item(idx:%04X) from page %d, offset:%d", 
-			item.header.idx, idx, offset);
-		item.header.idx = 0;
-		ret = st_page_write(idx, offset, (uint8_t *)&item.header, 
-			sizeof(st_item_header_t));
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to write item header.");
-			goto fail;
-		}
-		if (page->item_cnt){
-			page->item_cnt -= 1;
-			page->bytes_available -= ST_ITEM_SIZE(&item);
-		}
-		cnt ++;
-		offset += ST_ITEM_SIZE(&item);
-	}
-	if (!page->item_cnt && ST_PAGE_S_FULL == page->status){
-		ret = st_page_erase(ctx, idx);
-		if (ret < 0){
-			LOG_ERROR(TAG, "erase failed.");
-		}
+	LOG_DEBUG(TAG, "write item(idx:%04X,len:%d,crc:%02X) to page %d, offset:%d", 
+		item->header.idx, item->header.len, item->header.crc, idx, 
+		ctx->pages[idx].bytes_used);
+	ret = st_page_append(ctx, idx, (uint8_t *)item, ST_ITEM_SIZE(item));
+	if (ret < 0){
+		LOG_ERROR(TAG, "fail to write item.");
+		return -1;
 	}
-	return cnt;
-fail:
-	return -1;
+	ctx->pages[idx].bytes_available += ST_ITEM_SIZE(item);
+	ctx->pages[idx].item_cnt ++;
+	return ret;
 }
-int st_delete_item_with_loc(st_ctx_t *ctx, uint16_t item_idx, st_item_location_t *location){
+
+static int st_delete_item_with_loc(st_ctx_t *ctx, uint16_t item_idx, 
+	st_item_location_t *location)
+{
 	st_page_t *page = NULL;
 	st_item_header_t header = {0};
 	int ret = 0;
@@ -488,7 +601,7 @@ int st_delete_item_with_loc(st_ctx_t *ctx, uint16_t item_idx, st_item_location_t
 		goto fail;
 	}
 	if (!ST_PAGE_VALID(location->page)){
-		LOG_ERROR(TAG, "%s:invalid page idx(%d)", location->page, __FUNCTION__);
+		LOG_ERROR(TAG, "%s:invalid page idx(%d)", __FUNCTION__, location->page);
 		goto fail;
 	}
 	page = &ctx->pages[location->page];
@@ -508,15 +621,14 @@ int st_delete_item_with_loc(st_ctx_t *ctx, uint16_t item_idx, st_item_location_t
 	}
 	LOG_DEBUG(TAG, "delete item(idx:%04X) from page %d, offset:%d", 
 			item_idx, location->page, location->offset);
-	header.idx = 0;
-	ret = st_page_write(location->page, location->offset, (uint8_t *)&header, 
-		sizeof(st_item_header_t));
+	ret = st_page_invalidate(location->page, location->offset);
 	if (ret < 0){
 		LOG_ERROR(TAG, "%s:fail to write header", __FUNCTION__);
 		goto fail;
 	}
 	if (page->item_cnt){
 		page->item_cnt --;
+		page->bytes_available -= header.len + sizeof(st_item_header_t);
 	}
 	if (!page->item_cnt && ST_PAGE_S_FULL == page->status){
 		ret = st_page_erase(ctx, location->page);
@@ -530,88 +642,336 @@ out:
 fail:
 	return -1;
 }
-static int st_page_find_item(st_ctx_t *ctx, uint16_t idx, 
-	st_item_t *result)
-{
+
+/**
+ * @brief start compacting page "idx", its items are moved by st_gc_step
+ */
+static void st_gc_start(st_ctx_t *ctx, uint16_t idx){
+	LOG_DEBUG(TAG, "page %d compaction start", idx);
+	ctx->gc_page = idx;
+	ctx->gc_offset = 0;
+}
+
+/**
+ * @brief move at most "item_max" live items of the page being compacted to 
+ * the active page, the source records are invalidated right after they are 
+ * copied. The page is erased once all of its records are visited.
+ * @return (-1)-error, 0-no compaction in progress(any more), 1-more to move
+ */
+static int st_gc_step(st_ctx_t *ctx, int item_max){
 	st_page_t *page = NULL;
 	st_item_t item = {0};
-	uint16_t offset = 0;
-	int cnt = 0;
+	st_index_entry_t *entry = NULL;
+	st_item_location_t location = {0};
+	uint16_t idx = ctx->gc_page;
 	int ret = 0;
-	if (!ctx){
-		return -1;
-	}
 	if (!ST_PAGE_VALID(idx)){
-		return -1;
-	}
-	if (!ST_ITEM_IDX_VALID(ctx->search_ctx.item_idx)){
-		LOG_ERROR(TAG, "invalid item idx.");
-		return -1;
-	}
-	page = &ctx->pages[idx];
-	if (ST_PAGE_S_ERASED == page->status || 
-		ST_PAGE_S_UNAVAILABLE == page->status)
-	{
 		return 0;
 	}
-	while(offset < page->bytes_used){
-		ret = st_page_read(idx, offset, (uint8_t *)&item.header, 
+	page = &ctx->pages[idx];
+	while(ctx->gc_offset < page->bytes_used){
+		ret = st_page_read(idx, ctx->gc_offset, (uint8_t *)&item.header, 
 			sizeof(st_item_header_t));
 		if (ret < 0){
 			LOG_ERROR(TAG, "fail to read item header.");
 			goto fail;
 		}
-		if (!item.header.idx){
-			offset += item.header.len + sizeof(st_item_header_t);
+		if (!ST_ITEM_IDX_VALID(item.header.idx)){
+			ret = st_page_next_record(idx, ctx->gc_offset, &item.header);
+			if (ret < 0){
+				goto fail;
+			}
+			ctx->gc_offset = ret;
 			continue;
 		}
-		if (item.header.idx != ctx->search_ctx.item_idx){
-			offset += item.header.len + sizeof(st_item_header_t);
+		// skip records superseded by a newer one
+		entry = st_index_find(ctx, item.header.idx, NULL);
+		if (entry && (entry->location.page != idx || 
+			entry->location.offset != ctx->gc_offset))
+		{
+			ctx->gc_offset += ST_ITEM_SIZE(&item);
 			continue;
 		}
-		LOG_DEBUG(TAG, "find idx %04X in page %d with offset %d", item.header.idx, 
-			idx, offset);
-		ret = st_page_read(idx, offset + sizeof(st_item_header_t), 
+		if (item_max <= 0){
+			return 1;
+		}
+		ret = st_page_read(idx, ctx->gc_offset + sizeof(st_item_header_t), 
 			item.content, item.header.len);
 		if (ret < 0){
 			LOG_ERROR(TAG, "fail to read item content.");
 			goto fail;
 		}
+		location.page = idx;
+		location.offset = ctx->gc_offset;
+		ctx->gc_offset += ST_ITEM_SIZE(&item);
 		if (!st_item_verify(&item)){
 			LOG_ERROR(TAG, "item verify failed.");
-			item.header.idx = 0;
-			st_page_write(idx, offset, (uint8_t *)&item.header, sizeof(st_item_header_t));
-			offset += item.header.len + sizeof(st_item_header_t);
-			continue;
-		}
-		if (result){
-			memcpy(result, &item, sizeof(st_item_t));
-		}
-		//delete last record if exist;
-		if (ST_PAGE_VALID(ctx->search_ctx.last_location.page)){
-			ret = st_delete_item_with_loc(ctx, idx, 
-				&ctx->search_ctx.last_location);
+			st_index_remove(ctx, item.header.idx);
+		}else{
+			if (!ST_PAGE_VALID(ctx->page_active) || 
+				st_page_get_freesize(ctx, ctx->page_active) < 
+				(int)ST_ITEM_SIZE(&item))
+			{
+				if (st_page_switch(ctx) < 0){
+					LOG_ERROR(TAG, "no enougn page.");
+					goto fail;
+				}
+			}
+			ret = st_page_write_item(ctx, ctx->page_active, &item);
 			if (ret < 0){
-				LOG_ERROR(TAG, "fail to delete last record");
+				LOG_ERROR(TAG, "fail to write item.");
 				goto fail;
 			}
+			st_index_update(ctx, item.header.idx, item.header.len, 
+				ctx->page_active, ret);
+		}
+		// erases the page once its last item is gone
+		if (st_delete_item_with_loc(ctx, item.header.idx, &location) < 0){
+			goto fail;
+		}
+		if (!ST_PAGE_VALID(ctx->gc_page)){
+			return 0;
+		}
+		item_max --;
+	}
+	ret = st_page_erase(ctx, idx);
+	if (ret < 0){
+		LOG_ERROR(TAG, "erase err.");
+		goto fail;
+	}
+	return 0;
+fail:
+	return -1;
+}
+
+/**
+ * @brief gc score of a FULL page, its reclaimable bytes discounted by how much 
+ * more it is worn than the least worn page
+ */
+static uint32_t st_page_gc_score(st_page_t *page, uint32_t erase_min){
+	uint32_t garbage = ST_PAGE_CONTENT_MAX - page->bytes_available;
+	return garbage * ST_WEAR_WEIGHT / 
+		(ST_WEAR_WEIGHT + page->erase_cnt - erase_min);
+}
+
+/**
+ * @brief find the FULL page with the best gc score. Without an erased page 
+ * only pages whose items fit into the active page are candidates.
+ * @return index of the page, ST_PAGE_MAX if none
+ */
+static uint16_t st_gc_select(st_ctx_t *ctx){
+	st_page_t *page = NULL;
+	int i = 0;
+	int room = ST_PAGE_CONTENT_MAX;
+	uint32_t erase_min = ST_ERASE_CNT_UNKNOWN;
+	uint32_t score = 0;
+	uint32_t score_best = 0;
+	uint16_t page_idx = ST_PAGE_MAX;
+	if (!ctx->page_erased){
+		room = st_page_get_freesize(ctx, ctx->page_active);
+	}
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		erase_min = MIN(erase_min, ctx->pages[i].erase_cnt);
+	}
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		page = &ctx->pages[i];
+		if (ST_PAGE_S_FULL != page->status || 
+			(page->item_cnt && page->bytes_available > room))
+		{
+			continue;
+		}
+		score = st_page_gc_score(page, erase_min);
+		if (!ST_PAGE_VALID(page_idx) || score > score_best){
+			page_idx = i;
+			score_best = score;
 		}
-		ctx->search_ctx.last_location.page = idx;
-		ctx->search_ctx.last_location.offset = offset;
-		memcpy(&ctx->search_ctx.last_header, (uint8_t *)&item.header, 
+	}
+	return page_idx;
+}
+
+/**
+ * @brief compact a whole page right away, finishing the compaction in 
+ * progress if any, or starting one on the page with the best gc score.
+ * @return (-1)-error, 0-no page to realign, 1-one page realigned
+ */
+static int st_realign(st_ctx_t *ctx){
+	uint16_t page_idx = ST_PAGE_MAX;
+	if (!ctx){
+		LOG_ERROR(TAG, "%s:param err", __FUNCTION__);
+		return -1;
+	}
+	if (!ST_PAGE_VALID(ctx->gc_page)){
+		page_idx = st_gc_select(ctx);
+		if (!ST_PAGE_VALID(page_idx)){
+			LOG_DEBUG(TAG, "%s:page not found", __FUNCTION__);
+			return 0;
+		}
+		st_gc_start(ctx, page_idx);
+	}
+	page_idx = ctx->gc_page;
+	if (st_gc_step(ctx, ST_PAGE_CONTENT_MAX) < 0){
+		LOG_ERROR(TAG, "page %d realign failed", page_idx);
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * @brief Pages holding cold data are never collected for garbage, start 
+ * compacting such a page once it lags the most worn page by 
+ * ST_WEAR_DELTA_MAX erases, so that it joins the erase rotation. Checked 
+ * after every erase, so that all lagging pages are moved in turn.
+ * @return 0-wear is balanced, 1-compaction started
+ */
+static int st_wear_level(st_ctx_t *ctx){
+	uint16_t page_cold = ST_PAGE_MAX;
+	int i = 0;
+	if (!ctx->flag_wear_check || ctx->page_erased <= 1 || 
+		ST_PAGE_VALID(ctx->gc_page))
+	{
+		return 0;
+	}
+	ctx->flag_wear_check = 0;
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		if (ST_PAGE_S_FULL == ctx->pages[i].status && 
+			(!ST_PAGE_VALID(page_cold) || 
+			ctx->pages[i].erase_cnt < ctx->pages[page_cold].erase_cnt))
+		{
+			page_cold = i;
+		}
+	}
+	if (!ST_PAGE_VALID(page_cold) || 
+		ctx->erase_max - ctx->pages[page_cold].erase_cnt <= ST_WEAR_DELTA_MAX)
+	{
+		return 0;
+	}
+	LOG_DEBUG(TAG, "wear leveling, page %d erased %u times, max %u", 
+		page_cold, ctx->pages[page_cold].erase_cnt, ctx->erase_max);
+	st_gc_start(ctx, page_cold);
+	return 1;
+}
+
+/**
+ * @brief start a compaction if none is running: the least worn page if wear 
+ * is unbalanced, or the page with the best gc score once no more than 
+ * ST_GC_PAGE_LOW pages are erased.
+ */
+static void st_gc_schedule(st_ctx_t *ctx){
+	uint16_t page_idx = ST_PAGE_MAX;
+	if (ST_PAGE_VALID(ctx->gc_page) || !ctx->page_erased){
+		return;
+	}
+	if (st_wear_level(ctx) || ctx->page_erased > ST_GC_PAGE_LOW){
+		return;
+	}
+	page_idx = st_gc_select(ctx);
+	if (ST_PAGE_VALID(page_idx) && ctx->pages[page_idx].bytes_available + 
+		ST_GC_GARBAGE_MIN <= ST_PAGE_CONTENT_MAX)
+	{
+		st_gc_start(ctx, page_idx);
+	}
+}
+
+/**
+ * @brief find the latest record of an item in a page
+ * @return (-1)-error, 0-not found, 1-found
+ */
+static int st_page_find_item(st_ctx_t *ctx, uint16_t idx, uint16_t item_idx, 
+	st_index_entry_t *result)
+{
+	st_page_t *page = NULL;
+	st_item_header_t header = {0};
+	uint16_t offset = 0;
+	int cnt = 0;
+	int ret = 0;
+	if (!ST_PAGE_VALID(idx)){
+		return -1;
+	}
+	page = &ctx->pages[idx];
+	if (ST_PAGE_S_ERASED == page->status || 
+		ST_PAGE_S_UNAVAILABLE == page->status)
+	{
+		return 0;
+	}
+	while(offset < page->bytes_used){
+		ret = st_page_read(idx, offset, (uint8_t *)&header, 
 			sizeof(st_item_header_t));
-		cnt ++;
-		offset += item.header.len + sizeof(st_item_header_t);
+		if (ret < 0){
+			LOG_ERROR(TAG, "fail to read item header.");
+			goto fail;
+		}
+		if (header.idx == item_idx){
+			result->item_idx = item_idx;
+			result->len = header.len;
+			result->location.page = idx;
+			result->location.offset = offset;
+			cnt = 1;
+		}
+		ret = st_page_next_record(idx, offset, &header);
+		if (ret < 0){
+			goto fail;
+		}
+		offset = ret;
 	}
 	return cnt;
 fail:
 	return -1;
 }
 
+/**
+ * @brief locate the latest record of an item. The index is used if possible, 
+ * pages are scanned from the newest to the oldest only when the index is 
+ * overflowed.
+ * @return (-1)-error, 0-not found, 1-found
+ */
+static int st_find_item(st_ctx_t *ctx, uint16_t item_idx, 
+	st_index_entry_t *result)
+{
+	st_index_entry_t *entry = NULL;
+	uint16_t page_start = ctx->page_last;
+	int i = 0;
+	int ret = 0;
+	if (!ST_ITEM_IDX_VALID(item_idx)){
+		goto fail;
+	}
+	entry = st_index_find(ctx, item_idx, NULL);
+	if (entry){
+		memcpy(result, entry, sizeof(st_index_entry_t));
+		return 1;
+	}
+	if (!ctx->flag_index_overflow){
+		return 0;
+	}
+	if (!ST_PAGE_VALID(page_start)){
+		page_start = 0;
+	}
+	i = page_start; 
+	do{
+		if (ST_PAGE_S_FULL == st_page_status(ctx, i) || 
+			ST_PAGE_S_ACTIVE == st_page_status(ctx, i))
+		{
+			ret = st_page_find_item(ctx, i, item_idx, result);
+			if (ret < 0){
+				goto fail;
+			}
+			if (ret > 0){
+				return 1;
+			}
+		}
+		i = st_page_last(i);
+	}while(i != page_start);
+	return 0;
+fail:
+	return -1;
+}
+
 static worktime_t lasttime;
 
 /**
- * @brief scan whole page
+ * @brief scan whole page and add its items to index. The active page must be 
+ * scanned first, so that stale copies left by an interrupted write can be 
+ * recognized and dropped. Other pages can only hold identical copies left by 
+ * an interrupted realign.
  * @param ctx Storage context
  * @param idx page index
  * @return 0-success, -1 - error
@@ -619,14 +979,14 @@ static worktime_t lasttime;
 static int st_page_scan(st_ctx_t *ctx, uint16_t idx){
 	st_page_t *page = NULL;
 	st_item_t item = {0};
+	st_index_entry_t *entry = NULL;
 	int ret = 0;
 	page = &ctx->pages[idx];
-	uint32_t addr = idx * ST_PAGE_SIZE;
-	uint32_t bytes_read = sizeof(item.header);
 	page->bytes_used = 0;
+	page->bytes_available = 0;
 	page->item_cnt = 0;
 	LOG_DEBUG(TAG, "scan page %d", idx);
-	while(page->bytes_used < ST_PAGE_CONTENT_MAX){
+	while(page->bytes_used + sizeof(st_item_header_t) <= ST_PAGE_CONTENT_MAX){
 		//read item content
 		ret = st_page_read(idx, page->bytes_used, 
 			(uint8_t *)&item.header, sizeof(item.header));
@@ -635,8 +995,36 @@ static int st_page_scan(st_ctx_t *ctx, uint16_t idx){
 			goto fail;
 		}
 		if (0xFFU == item.header.len){
+			ret = st_page_seal(idx, page->bytes_used);
+			if (ret < 0){
+				LOG_ERROR(TAG, "fail to seal page.");
+				goto fail;
+			}
+			if (ret){
+				continue;
+			}
 			break;
 		}
+		if (ST_ITEM_IDX_BATCH == item.header.idx){
+			ret = st_page_read(idx, page->bytes_used + sizeof(st_item_header_t), 
+				item.content, sizeof(st_batch_header_t));
+			if (ret < 0){
+				LOG_ERROR(TAG, "fail to read batch header.");
+				goto fail;
+			}
+			if (st_batch_verify(&item.header, 
+				(st_batch_header_t *)item.content))
+			{
+				// items of the batch follow as ordinary records
+				page->bytes_used += ST_BATCH_RECORD_SIZE;
+				continue;
+			}
+			LOG_ERROR(TAG, "drop corrupt batch at page %d, offset:%d", 
+				idx, page->bytes_used);
+			st_page_invalidate(idx, page->bytes_used);
+			page->bytes_used += item.header.len + sizeof(st_item_header_t);
+			continue;
+		}
 		if (ST_ITEM_IDX_VALID(item.header.idx)){
 			LOG_DEBUG(TAG, "item len:%d, idx:0x%04x, crc:%02x", item.header.len,
 				item.header.idx, item.header.crc);
@@ -650,19 +1038,32 @@ static int st_page_scan(st_ctx_t *ctx, uint16_t idx){
 			// verify item content, mark it erased if content is corrupt.
 			if (!st_item_verify(&item)){
 				LOG_ERROR(TAG, "item verify failed.");
-				item.header.idx = 0;
-				st_page_write(idx, page->bytes_used, (uint8_t *)&item.header, sizeof(st_item_header_t));
+				st_page_invalidate(idx, page->bytes_used);
+				page->bytes_used += item.header.len + sizeof(st_item_header_t);
+				continue;
+			}
+			entry = st_index_find(ctx, item.header.idx, NULL);
+			if (entry && entry->location.page != idx){
+				// a newer page already holds this item
+				LOG_DEBUG(TAG, "drop stale item(idx:%04X)", item.header.idx);
+				st_page_invalidate(idx, page->bytes_used);
 				page->bytes_used += item.header.len + sizeof(st_item_header_t);
 				continue;
 			}
+			if (entry){
+				// an older record of this item in the same page
+				LOG_DEBUG(TAG, "drop stale item(idx:%04X)", item.header.idx);
+				st_page_invalidate(idx, entry->location.offset);
+				page->bytes_available -= entry->len + sizeof(st_item_header_t);
+				page->item_cnt --;
+			}
+			st_index_update(ctx, item.header.idx, item.header.len, idx, 
+				page->bytes_used);
 			page->bytes_available += item.header.len + sizeof(st_item_header_t);
 			page->item_cnt ++;
 		}
 		page->bytes_used += item.header.len + sizeof(st_item_header_t);
 	}
-	if (page->bytes_used >= ST_PAGE_CONTENT_MAX){
-		st_page_status_update(ctx, idx, ST_PAGE_S_FULL);
-	}
 	// erase page if status is FULL and all item was marked as erased
 	if (ST_PAGE_S_FULL == page->status && !page->item_cnt){
 		ret = st_page_erase(ctx, idx);
@@ -678,18 +1079,134 @@ fail:
 	return -1;
 }
 
+/**
+ * @return 1 if no record was written to the page
+ */
+static int st_page_empty(uint16_t idx){
+	uint8_t len = 0;
+	if (st_page_read(idx, 0, &len, sizeof(len)) < 0){
+		return 0;
+	}
+	return 0xFFU == len;
+}
+
+/**
+ * @brief get the page the next migrated record of "size" bytes goes to
+ * @return (-1)-error, index of the page
+ */
+static int st_migrate_page(st_ctx_t *ctx, uint16_t size){
+	if (ST_PAGE_VALID(ctx->page_active) && 
+		st_page_get_freesize(ctx, ctx->page_active) >= size)
+	{
+		return ctx->page_active;
+	}
+	return st_page_switch(ctx);
+}
+
+/**
+ * @brief move the live items of a page in the old layout into the log, then 
+ * erase it. Items already in the log were moved by an interrupted migration 
+ * and are skipped. Without an erased page to move to, the page is buffered 
+ * and erased first, its items are lost if power fails before they are 
+ * written back.
+ * @return (-1)-error, 0-success
+ */
+static int st_page_migrate(st_ctx_t *ctx, uint16_t idx){
+	uint8_t buf[ST_PAGE_SIZE];
+	st_item_t item = {0};
+	st_index_entry_t entry = {0};
+	uint16_t offset = ST_OLD_HEADER_SIZE;
+	uint8_t flag_erased = 0;
+	int page_idx = 0;
+	int ret = 0;
+	LOG_DEBUG(TAG, "migrate page %d from the old layout", idx);
+	if (EEPROM_READ(idx * ST_PAGE_SIZE, buf, ST_PAGE_SIZE)){
+		LOG_ERROR(TAG, "read err.");
+		goto fail;
+	}
+	if (!ctx->page_erased){
+		if (st_page_erase(ctx, idx) < 0){
+			LOG_ERROR(TAG, "erase err");
+			goto fail;
+		}
+		flag_erased = 1;
+	}
+	while(offset + sizeof(st_item_header_t) <= ST_PAGE_SIZE){
+		memcpy(&item.header, buf + offset, sizeof(st_item_header_t));
+		if (0xFFU == item.header.len || 
+			offset + ST_ITEM_SIZE(&item) > ST_PAGE_SIZE)
+		{
+			break;
+		}
+		offset += ST_ITEM_SIZE(&item);
+		// deleted records have idx 0
+		if (!ST_ITEM_IDX_VALID(item.header.idx) || 
+			item.header.len > ST_MAX_CONTENT_LEN)
+		{
+			continue;
+		}
+		memcpy(item.content, buf + offset - item.header.len, item.header.len);
+		if (!st_item_verify(&item)){
+			LOG_ERROR(TAG, "drop corrupt item(idx:%04X)", item.header.idx);
+			continue;
+		}
+		ret = st_find_item(ctx, item.header.idx, &entry);
+		if (ret < 0){
+			goto fail;
+		}
+		if (ret){
+			continue;
+		}
+		page_idx = st_migrate_page(ctx, ST_ITEM_SIZE(&item));
+		if (page_idx < 0){
+			LOG_ERROR(TAG, "no enough space");
+			goto fail;
+		}
+		ret = st_page_write_item(ctx, page_idx, &item);
+		if (ret < 0){
+			goto fail;
+		}
+		st_index_update(ctx, item.header.idx, item.header.len, page_idx, ret);
+	}
+	if (!flag_erased && st_page_erase(ctx, idx) < 0){
+		LOG_ERROR(TAG, "erase err");
+		goto fail;
+	}
+	return 0;
+fail:
+	return -1;
+}
+
 static int st_page_init(st_ctx_t *ctx){
 	st_page_t *page = NULL;
 	int ret = 0;
 	uint16_t idx = ST_PAGE_MAX;
+	uint16_t page_start = 0;
+	uint16_t page_new = ST_PAGE_MAX;
+	st_page_header_t header = {0};
+	uint32_t erase_max = 0;
+	uint8_t flag_migrate = 0;
 
 	for(idx = 0; idx < ST_PAGE_MAX; idx++){
 		page = &ctx->pages[idx];
 		memset(page, 0, sizeof(st_page_t));
-		if (EEPROM_READ(idx * ST_PAGE_SIZE, &page->status, sizeof(page->status))){
-			LOG_ERROR(TAG, "fail to read page status");
+		if (EEPROM_READ(idx * ST_PAGE_SIZE, &header, sizeof(header))){
+			LOG_ERROR(TAG, "fail to read page header");
 			goto fail;
 		}
+		page->status = header.status;
+		page->erase_cnt = header.erase_cnt[0] | (header.erase_cnt[1] << 8) | 
+			((uint32_t)header.erase_cnt[2] << 16);
+		// only pages in the new layout hold a counter, bytes 1..3 of other 
+		// pages are old layout items or garbage
+		if (ST_PAGE_S_ERASED != page->status && 
+			ST_PAGE_S_ACTIVE != page->status && 
+			ST_PAGE_S_FULL != page->status)
+		{
+			page->erase_cnt = ST_ERASE_CNT_UNKNOWN;
+		}else if (ST_ERASE_CNT_UNKNOWN != page->erase_cnt){
+			erase_max = MAX(erase_max, page->erase_cnt);
+		}
 		LOG_DEBUG(TAG, "page %d: %s", idx, st_page_status_str(page->status));
 		switch(page->status){
 			case ST_PAGE_S_UNAVAILABLE:
@@ -700,22 +1217,36 @@ static int st_page_init(st_ctx_t *ctx){
 					LOG_ERROR(TAG, "erase check err.");
 					goto fail;
 				}
-				if (!ret){
-					LOG_ERROR(TAG, "erace check failed. erase again");
-					if (st_page_erase(ctx, idx) < 0){
-						LOG_ERROR(TAG, "erase err");
-						goto fail;
-					}
+				if (ret){
+					ctx->page_erased ++;
+					break;
+				}
+				LOG_ERROR(TAG, "erace check failed. erase again");
+				page->status = ST_PAGE_S_UNAVAILABLE;
+				if (st_page_erase(ctx, idx) < 0){
+					LOG_ERROR(TAG, "erase err");
+					goto fail;
 				}
-				ctx->page_erased ++;
 				break;
-			case ST_PAGE_S_FULL:
 			case ST_PAGE_S_ACTIVE:
-				if (st_page_scan(ctx, idx)){
-					LOG_ERROR(TAG, "fail to load page");
-					goto fail;
+				// two ACTIVE pages are left by an interrupted st_page_switch, 
+				// the newly activated one holds no record yet
+				if (!ST_PAGE_VALID(ctx->page_active)){
+					ctx->page_active = idx;
+				}else if (st_page_empty(ctx->page_active)){
+					page_new = ctx->page_active;
+					ctx->page_active = idx;
+				}else{
+					page_new = idx;
 				}
-				ctx->page_active = idx;
+				ctx->page_last = ctx->page_active;
+				break;
+			case ST_PAGE_S_FULL:
+				break;
+			case ST_PAGE_S_OLD_ACTIVE:
+			case ST_PAGE_S_OLD_FULL:
+				// migrated once the pages in the new layout are loaded
+				flag_migrate = 1;
 				break;
 			default:
 				LOG_ERROR(TAG, "unknown status(%02x), erase whole page", page->status);
@@ -726,8 +1257,55 @@ static int st_page_init(st_ctx_t *ctx){
 				page->status = 0xff;
 		}
 	}
-	LOG_DEBUG(TAG, "page init finish, erased:%d, active:%d", ctx->page_erased,
-		ctx->page_active);
+	// counters lost by an interrupted erase are estimated by the most worn page
+	for(idx = 0; idx < ST_PAGE_MAX; idx++){
+		page = &ctx->pages[idx];
+		if (ST_ERASE_CNT_UNKNOWN != page->erase_cnt){
+			continue;
+		}
+		page->erase_cnt = erase_max;
+		if (ST_PAGE_S_ERASED == page->status){
+			st_page_erase_cnt_write(idx, page->erase_cnt);
+		}
+	}
+	ctx->erase_max = MAX(ctx->erase_max, erase_max);
+	ctx->flag_wear_check = 1;
+	// load pages starting from the active one, which holds the newest records
+	if (ST_PAGE_VALID(ctx->page_active)){
+		page_start = ctx->page_active;
+	}
+	idx = page_start;
+	do{
+		page = &ctx->pages[idx];
+		if (ST_PAGE_S_FULL == page->status || 
+			ST_PAGE_S_ACTIVE == page->status)
+		{
+			if (st_page_scan(ctx, idx)){
+				LOG_ERROR(TAG, "fail to load page");
+				goto fail;
+			}
+		}
+		idx = st_page_last(idx);
+	}while(idx != page_start);
+	if (ST_PAGE_VALID(page_new)){
+		LOG_DEBUG(TAG, "finish switching from page %d to %d", ctx->page_active, 
+			page_new);
+		st_page_status_update(ctx, ctx->page_active, ST_PAGE_S_FULL);
+		ctx->page_active = page_new;
+		ctx->page_last = page_new;
+	}
+	for(idx = 0; flag_migrate && idx < ST_PAGE_MAX; idx++){
+		if (ST_PAGE_S_OLD_ACTIVE == ctx->pages[idx].status || 
+			ST_PAGE_S_OLD_FULL == ctx->pages[idx].status)
+		{
+			if (st_page_migrate(ctx, idx) < 0){
+				LOG_ERROR(TAG, "fail to migrate page %d", idx);
+				goto fail;
+			}
+		}
+	}
+	LOG_DEBUG(TAG, "page init finish, erased:%d, active:%d, indexed:%d", 
+		ctx->page_erased, ctx->page_active, ctx->index_cnt);
 	return 0;
 fail:
 	return -1;
@@ -736,7 +1314,6 @@ fail:
 int st_erase_all(st_ctx_t *ctx){
 	int i = 0;
 	int ret = 0;
-	st_page_status_t page_status = {0};
 	for(i = 0; i < ST_PAGE_MAX; i++){
 		if (ST_PAGE_S_ERASED == ctx->pages[i].status){
 			continue;
@@ -760,120 +1337,85 @@ fail:
 
 int st_init(){
 	int ret = 0;
-	st_page_status_t page_status = {0};
 	st_ctx.page_start = ST_PAGE_MAX;
 	st_ctx.page_active = ST_PAGE_MAX;
+	st_ctx.page_last = ST_PAGE_MAX;
+	st_ctx.page_erased = 0;
+	st_ctx.erase_max = 0;
+	st_ctx.gc_page = ST_PAGE_MAX;
+	st_ctx.index_cnt = 0;
+	st_ctx.flag_index_overflow = 0;
 	lasttime = worktime_get();
-	st_page_init(&st_ctx);
+	ret = st_page_init(&st_ctx);
+	if (ret < 0){
+		LOG_ERROR(TAG, "page init failed.");
+	}
 	st_ctx.flag_init = 1;
-	
-out:
 	return 0;
-fail:
-	return -1;
-}
-
-static int st_find_item(uint16_t item_idx, st_item_t *result, 
-	st_item_location_t *location)
-{
-	st_ctx_t *ctx = &st_ctx;
-	uint16_t page_start = ctx->page_active;
-	int i = 0;
-	int ret, cnt;
-	ret = cnt = 0;
-	if (!ST_ITEM_IDX_VALID(item_idx)){
-		goto fail;
-	}
-	if (!ST_PAGE_VALID(page_start)){
-		page_start = 0;
-	}
-	ctx->search_ctx.item_idx = item_idx;
-	ctx->search_ctx.last_location.page = ST_PAGE_MAX;
-	i = page_start; 
-	do{
-		if (ST_PAGE_S_FULL == st_page_status(ctx, i) || 
-			ST_PAGE_S_ACTIVE == st_page_status(ctx, i))
-		{
-			if (cnt){
-				result = NULL;
-			}
-			ret = st_page_find_item(ctx, i, result);
-			if (ret < 0){
-				goto fail;
-			}
-			cnt += ret;
-			if (1 == cnt && location){
-				memcpy(location, &ctx->search_ctx.last_location, 
-					sizeof(st_item_location_t));
-			}
-			if (cnt > 1){
-				ret = st_delete_item_with_loc(ctx, item_idx, &ctx->search_ctx.last_location);
-				if (ret < 0){
-					LOG_ERROR(TAG, "fail to delete item");
-					goto fail;
-				}
-			}
-		}
-		i = st_page_last(i);
-	}while(i != page_start);
-	
-	return cnt;
-fail:
-	return -1;
 }
 
 static int st_get_available_page(st_ctx_t *ctx, uint16_t data_len){
 	int i = 0;
 	int ret = 0;
 	uint16_t page_idx = ST_PAGE_MAX;
-	st_page_status_t page_status = {0};
 	if (!ctx){
 		return -1;
 	}
 	if (data_len + sizeof(st_item_header_t) > ST_MAX_CONTENT_LEN){
 		return -1;
 	}
+	// an interrupted realign may have consumed the reserved erased page, 
+	// restore it before more data goes to the active page
+	for (i = 0; i < ST_PAGE_MAX && !ctx->page_erased; i++){
+		if (st_realign(ctx) <= 0){
+			break;
+		}
+	}
+	// pay for a bounded compaction step, nothing left to do if st_poll keeps 
+	// up with the writes
+	st_gc_schedule(ctx);
+	if (st_gc_step(ctx, ST_GC_STEP_ITEMS) < 0){
+		goto fail;
+	}
 	if (ST_PAGE_VALID(ctx->page_active)){
 		page_idx = ctx->page_active;
 	}else{
 		page_idx = st_first_page(ctx, 0, ST_PAGE_S_ACTIVE);
 	}
-	if (ST_PAGE_VALID(page_idx)){
-		if (st_page_get_freesize(ctx, page_idx) >= 
-			data_len + sizeof(st_item_header_t))
-		{
-			return page_idx;
+	if (ST_PAGE_VALID(page_idx) && st_page_get_freesize(ctx, page_idx) >= 
+		(int)(data_len + sizeof(st_item_header_t)))
+	{
+		return page_idx;
+	}
+	// keep erased pages in reserve, even if the active page was just filled up
+	for (i = 0; i < ST_PAGE_MAX && ctx->page_erased <= 2; i++){
+		if (st_realign(ctx) <= 0){
+			break;
 		}
-		if (ctx->page_erased <= 2){
-			st_realign(ctx);
-			//realign may change active page
+		//realign may change active page, or fill it up
+		if (ST_PAGE_VALID(ctx->page_active)){
 			page_idx = ctx->page_active;
-			if (st_page_get_freesize(ctx, page_idx) >= 
-				data_len + sizeof(st_item_header_t))
-			{
-				return page_idx;
-			}
 		}
-		ret = st_page_status_update(ctx, page_idx, ST_PAGE_S_FULL);
-		if (ret < 0){
-			LOG_ERROR(TAG, "fail to upadate status");
-			goto fail;
+		if (ST_PAGE_VALID(page_idx) && st_page_get_freesize(ctx, page_idx) >= 
+			(int)(data_len + sizeof(st_item_header_t)))
+		{
+			return page_idx;
+		}
+		if (ctx->page_erased > 1){
+			break;
 		}
-	}else{
-		page_idx = 0;
 	}
-	
-	page_idx = st_first_page(ctx, page_idx, ST_PAGE_S_ERASED);
-	if (!ST_PAGE_VALID(page_idx)){
+	// the last erased page is the target of realign, never fill it with data
+	if (ctx->page_erased <= 1){
 		LOG_ERROR(TAG, "no enough space");
 		goto fail;
 	}
-	ret = st_page_status_update(ctx, page_idx, ST_PAGE_S_ACTIVE);
+	ret = st_page_switch(ctx);
 	if (ret < 0){
-		LOG_ERROR(TAG, "fail to upadate status");
+		LOG_ERROR(TAG, "no enough space");
 		goto fail;
 	}
-	return page_idx;
+	return ret;
 fail:
 	return -1;
 }
@@ -889,46 +1431,155 @@ fail:
 int st_write_item(uint16_t item_idx, uint8_t *buf, int len)
 {
 	st_item_t item = {0};
-	st_item_location_t location = {0};
-	crc_type_t crc_type = CRC8_MAXIM_INIT;
+	st_index_entry_t last = {0};
 	uint16_t page_idx = ST_PAGE_MAX;
-	st_page_t *page = NULL;
 	st_ctx_t *ctx = &st_ctx;
-	int i = 0;
+	int found = 0;
 	int ret = 0;
+	if (!st_is_init()){
+		return -1;
+	}
 	if (!buf || len <= 0 || len > ST_MAX_CONTENT_LEN){
 		return -1;
 	}
 	if (!ST_ITEM_IDX_VALID(item_idx)){
 		return -1;
 	}
-	location.page = ST_PAGE_MAX;
-	ret = st_find_item(item_idx, &item, &location);
-	if (ret < 0){
-		LOG_ERROR(TAG, "fail to find item");
-		goto fail;
-	}
-	
 	item.header.idx = item_idx;
 	item.header.len = len;
 	memcpy(item.content, buf, len);
-	item.header.crc = crc_check(&crc_type, (const uint8_t *)item.content, len);
+	item.header.crc = crc_table_check(&crc8_maxim_table, 
+		(const uint8_t *)item.content, len);
 	page_idx = st_get_available_page(ctx, len);
 	if (!ST_PAGE_VALID(page_idx)){
 		LOG_ERROR(TAG, "no available page");
 		goto fail;
 	}
-	page = &ctx->pages[page_idx];
+	// page allocation may relocate the last record, look it up afterwards
+	found = st_find_item(ctx, item_idx, &last);
+	if (found < 0){
+		LOG_ERROR(TAG, "fail to find item");
+		goto fail;
+	}
 	ret = st_page_write_item(ctx, page_idx, &item);
 	if (ret < 0){
 		LOG_ERROR(TAG, "fail to write new item");
 		goto fail;
 	}
-	if (ST_PAGE_S_ACTIVE == page->status){
+	if (ST_PAGE_S_ACTIVE == ctx->pages[page_idx].status){
+		ctx->page_active = page_idx;
+	}
+	st_index_update(ctx, item_idx, len, page_idx, ret);
+	if (found){
+		ret = st_delete_item_with_loc(ctx, item_idx, &last.location);
+		if (ret < 0){
+			LOG_ERROR(TAG, "fail to delete old item");
+			goto fail;
+		}
+	}
+	return 0;
+fail:
+	return -1;
+}
+
+/**
+ * @brief write several items as one transaction. Items are packed into a 
+ * single batch record and written back to back, the length byte of the batch 
+ * record commits them together, superseded records are invalidated 
+ * afterwards. After a power loss either all or none of the items are updated.
+ * @param items items to write, item idx must be unique in the batch
+ * @param cnt number of items, no more than ST_BATCH_ITEM_MAX
+ * @return (-1)-ERROR, 0-success
+ */
+int st_write_batch(st_batch_item_t *items, int cnt)
+{
+	uint8_t buf[ST_MAX_CONTENT_LEN];
+	st_item_header_t header = {0};
+	st_batch_header_t batch = {0};
+	st_index_entry_t last[ST_BATCH_ITEM_MAX];
+	int8_t found[ST_BATCH_ITEM_MAX];
+	uint16_t page_idx = ST_PAGE_MAX;
+	uint16_t bytes = ST_BATCH_RECORD_SIZE;
+	uint16_t offset = 0;
+	st_ctx_t *ctx = &st_ctx;
+	int i = 0, j = 0;
+	int ret = 0;
+	if (!st_is_init()){
+		return -1;
+	}
+	if (!items || cnt <= 0 || cnt > ST_BATCH_ITEM_MAX){
+		return -1;
+	}
+	for (i = 0; i < cnt; i++){
+		if (!ST_ITEM_IDX_VALID(items[i].item_idx) || !items[i].buf || 
+			items[i].len <= 0)
+		{
+			return -1;
+		}
+		for (j = 0; j < i; j++){
+			if (items[j].item_idx == items[i].item_idx){
+				LOG_ERROR(TAG, "duplicate item(idx:%04X) in batch", 
+					items[i].item_idx);
+				return -1;
+			}
+		}
+		if (bytes + sizeof(st_item_header_t) + items[i].len > ST_MAX_CONTENT_LEN){
+			LOG_ERROR(TAG, "batch too large");
+			return -1;
+		}
+		header.len = items[i].len;
+		header.idx = items[i].item_idx;
+		header.crc = crc_table_check(&crc8_maxim_table, 
+			(const uint8_t *)items[i].buf, items[i].len);
+		memcpy(buf + bytes, &header, sizeof(header));
+		memcpy(buf + bytes + sizeof(header), items[i].buf, items[i].len);
+		bytes += sizeof(header) + items[i].len;
+	}
+	batch.item_cnt = cnt;
+	batch.reserved = 0xFF;
+	header.len = bytes - sizeof(st_item_header_t);
+	header.idx = ST_ITEM_IDX_BATCH;
+	header.crc = crc_table_check(&crc8_maxim_table, (const uint8_t *)&batch, 
+		sizeof(batch));
+	memcpy(buf, &header, sizeof(header));
+	memcpy(buf + sizeof(header), &batch, sizeof(batch));
+
+	page_idx = st_get_available_page(ctx, header.len);
+	if (!ST_PAGE_VALID(page_idx)){
+		LOG_ERROR(TAG, "no available page");
+		goto fail;
+	}
+	// page allocation may relocate the last records, look them up afterwards
+	for (i = 0; i < cnt; i++){
+		found[i] = st_find_item(ctx, items[i].item_idx, &last[i]);
+		if (found[i] < 0){
+			LOG_ERROR(TAG, "fail to find item");
+			goto fail;
+		}
+	}
+	LOG_DEBUG(TAG, "write batch(%d items, %d bytes) to page %d, offset:%d", 
+		cnt, bytes, page_idx, ctx->pages[page_idx].bytes_used);
+	ret = st_page_append(ctx, page_idx, buf, bytes);
+	if (ret < 0){
+		LOG_ERROR(TAG, "fail to write batch");
+		goto fail;
+	}
+	offset = ret;
+	if (ST_PAGE_S_ACTIVE == ctx->pages[page_idx].status){
 		ctx->page_active = page_idx;
 	}
-	if (ST_PAGE_VALID(location.page)){
-		ret = st_delete_item_with_loc(ctx, item_idx, &location);
+	ctx->pages[page_idx].item_cnt += cnt;
+	ctx->pages[page_idx].bytes_available += bytes - ST_BATCH_RECORD_SIZE;
+	offset += ST_BATCH_RECORD_SIZE;
+	for (i = 0; i < cnt; i++){
+		st_index_update(ctx, items[i].item_idx, items[i].len, page_idx, offset);
+		offset += sizeof(st_item_header_t) + items[i].len;
+	}
+	for (i = 0; i < cnt; i++){
+		if (!found[i]){
+			continue;
+		}
+		ret = st_delete_item_with_loc(ctx, items[i].item_idx, &last[i].location);
 		if (ret < 0){
 			LOG_ERROR(TAG, "fail to delete old item");
 			goto fail;
@@ -949,8 +1600,8 @@ fail:
 int st_read_item(uint16_t item_idx, uint8_t *buf, int len)
 {
 	st_item_t item = {0};
-	st_page_t *page = NULL;
-	int i = 0;
+	st_index_entry_t entry = {0};
+	st_ctx_t *ctx = &st_ctx;
 	int ret = 0;
 	if (!st_is_init()){
 		return -1;
@@ -961,40 +1612,67 @@ int st_read_item(uint16_t item_idx, uint8_t *buf, int len)
 	if (!ST_ITEM_IDX_VALID(item_idx)){
 		return -1;
 	}
-	ret = st_find_item(item_idx, &item, NULL);
+	ret = st_find_item(ctx, item_idx, &entry);
 	if (ret < 0){
 		goto fail;
 	}else if (0 == ret){
 		return 0;
 	}
+	ret = st_page_read(entry.location.page, entry.location.offset, 
+		(uint8_t *)&item, entry.len + sizeof(st_item_header_t));
+	if (ret < 0){
+		LOG_ERROR(TAG, "fail to read item.");
+		goto fail;
+	}
+	if (item.header.idx != item_idx || !st_item_verify(&item)){
+		LOG_ERROR(TAG, "item verify failed.");
+		st_index_remove(ctx, item_idx);
+		st_delete_item_with_loc(ctx, item_idx, &entry.location);
+		return 0;
+	}
 	memcpy(buf, item.content, MIN(len, item.header.len));
 	return MIN(len, item.header.len);
 fail:
 	return -1;
 }
 
+/**
+ * @brief delete item from data storage
+ * @param item_idx index of data item
+ * @return (-1)-ERROR, 0-item not found, 1-item deleted
+ */
 int st_delete_item(uint16_t item_idx){
 	st_ctx_t *ctx = &st_ctx;
-	int i = 0;
-	int ret, cnt;
-	ret = cnt = 0;
-	if (!ST_ITEM_IDX_VALID(item_idx)){
-		goto fail;
+	st_index_entry_t entry = {0};
+	int ret = 0;
+	if (!st_is_init()){
+		return -1;
 	}
-	for(i = ctx->page_start; st_page_next(i) != ctx->page_start; 
-		i = st_page_next(i))
-	{
-		if (ST_PAGE_S_ERASED == st_page_status(ctx, i)){
-			break;
-		}
-		ret = st_page_delete_item(ctx, i, item_idx);
-		if (ret < 0){
-			goto fail;
-		}
-		cnt += ret;
+	ret = st_find_item(ctx, item_idx, &entry);
+	if (ret <= 0){
+		return ret;
 	}
-	return cnt;
+	st_index_remove(ctx, item_idx);
+	ret = st_delete_item_with_loc(ctx, item_idx, &entry.location);
+	if (ret < 0){
+		goto fail;
+	}
+	return 1;
 fail:
 	return -1;
 }
 
+/**
+ * @brief Move a few items of the page being compacted. Call it in idle time 
+ * so that writes seldom have to, compaction starts when erased pages run low 
+ * or wear is unbalanced.
+ * @return (-1)-error, 0-nothing to do, 1-compaction in progress
+ */
+int st_poll(){
+	st_ctx_t *ctx = &st_ctx;
+	if (!st_is_init()){
+		return 0;
+	}
+	st_gc_schedule(ctx);
+	return st_gc_step(ctx, ST_GC_STEP_ITEMS);
+}
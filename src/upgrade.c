@@ -9,6 +9,7 @@
 #include "appinfo.h"
 #include "configtool.h"
 #include "display.h"
+#include "upgrade.h"
 
 typedef enum upgrade_status{
 	UPGRADE_S_INIT = 0,
@@ -20,6 +21,8 @@ typedef enum upgrade_operation{
 	UPGRADE_OPT_ERASE,
 	UPGRADE_OPT_FLASH,
 	UPGRADE_OPT_VERIFY,
+	UPGRADE_OPT_FLASH_B,
+	UPGRADE_OPT_COPY,	//backup part to app part, started by the bootloader
 }upgrade_opt_t;
 
 typedef enum upgrade_operation_status{
@@ -46,7 +49,9 @@ typedef struct upgrade_flash_context{
 	uint16_t data_crc;
 	const uint8_t *data_buf;
 	crc16_ctx_t flash_crc_ctx;
+	MD5_CTX md5_ctx;	//image hash including this buffer, kept if it's flashed
 	uint16_t progress;
+	uint8_t buf_idx;
 } upgrade_flash_ctx_t;
 
 typedef struct upgrade_verify_context{
@@ -62,14 +67,49 @@ typedef struct upgrade_erase_context{
 	uint16_t progress;
 } upgrade_erase_ctx_t;
 
+typedef struct upgrade_copy_context{
+	cfg_copy_t journal;
+	uint32_t bytes_erased;
+	uint16_t progress;
+} upgrade_copy_ctx_t;
+
+/**
+ * Firmware data frames, PDU: 
+ * function(1) | offset(4) | len(1) | crc16 of data(2) | data(len)
+ * Multi-byte fields are big endian, offset is relative to the backup part 
+ * and must be 4 bytes aligned. Offset 0 starts a new image. The response 
+ * echoes function, offset and len once the data is queued for flashing.
+ */
+#define UPGRADE_FUNC_WRITE	0x41
+#define UPGRADE_STREAM_HEADER_LEN	8
+#define UPGRADE_STREAM_DATA_MAX	244
+#define UPGRADE_STREAM_SLOTS	2
+
+typedef struct upgrade_stream_chunk{
+	uint32_t offset;
+	uint8_t data[UPGRADE_STREAM_DATA_MAX];	//4 bytes aligned for FLASH_ROM_WRITE
+	uint16_t len;
+} upgrade_stream_chunk_t;
+
+typedef struct upgrade_stream_context{
+	upgrade_stream_chunk_t chunk[UPGRADE_STREAM_SLOTS];
+	uint8_t head;	//next chunk to be flashed
+	uint8_t cnt;	//chunks waiting to be flashed
+	uint8_t err;
+	uint32_t bytes_recv;	//offset of the next chunk expected
+	uint32_t bytes_erased;	//backup part is erased up to here
+} upgrade_stream_ctx_t;
+
 typedef union upgrade_opt_context{
 	upgrade_flash_ctx_t flash;
 	upgrade_erase_ctx_t erase;
 	upgrade_verify_ctx_t verify;
+	upgrade_copy_ctx_t copy;
 } upgrade_opt_ctx_t;
 
 typedef struct upgrade_context{
 	cfg_ota_t otainfo;
+	cfg_boot_t bootinfo;
 	upgrade_status_t status;
 	worktime_t lasttime;
 	upgrade_opt_t opt_code;
@@ -82,9 +122,33 @@ typedef struct upgrade_context{
 	upgrade_opt_ctx_t opt_ctx;
 	uint32_t image_size;
 	uint32_t bytes_write;
-	MD5_CTX md5_ctx;
+	MD5_CTX md5_ctx;	//hash of the data flashed to the backup part
+	uint32_t bytes_hashed;
+	upgrade_stream_ctx_t stream;
+	uint8_t flag_pending;	//opt_pending flashes the other buffer next
+	upgrade_opt_t opt_pending;
 } upgrade_ctx_t;
 
+/**
+ * Data buffers, the master fills one while the other is being flashed. 
+ * Registers of a buffer run from len_h up to end.
+ */
+typedef struct upgrade_buf{
+	mb_reg_addr_t len_h;
+	mb_reg_addr_t len_l;
+	mb_reg_addr_t crc;
+	mb_reg_addr_t start;
+	mb_reg_addr_t end;
+	upgrade_opt_t opt_code;
+} upgrade_buf_t;
+
+static const upgrade_buf_t upgrade_bufs[MB_REG_DATA_BUF_NUM] = {
+	{MB_REG_ADDR_DATA_LEN_H, MB_REG_ADDR_DATA_LEN_L, MB_REG_ADDR_DATA_CRC, 
+		MB_REG_ADDR_BUF_START, MB_REG_ADDR_BUF_MAX, UPGRADE_OPT_FLASH},
+	{MB_REG_ADDR_DATA_B_LEN_H, MB_REG_ADDR_DATA_B_LEN_L, MB_REG_ADDR_DATA_B_CRC, 
+		MB_REG_ADDR_BUF_B_START, MB_REG_ADDR_BUF_B_MAX, UPGRADE_OPT_FLASH_B},
+};
+
 #define BOOT_PART_SIZE	(48 * 1024)
 #define BOOT_BLOCK_NUM	(BOOT_PART_SIZE / EEPROM_BLOCK_SIZE)
 
@@ -102,15 +166,91 @@ typedef struct upgrade_context{
 #define BACKUP_APPINFO_ADDR	(BACKUP_ADDR_START + APPINFO_OFFSET)
 #define GOTO_AP()	((void (*)(void))((uint32_t *)APP_ADDR_START))()
 
+/**
+ * Code flash is mapped at its flash address, so images are hashed in place. 
+ * Set UPGRADE_FLASH_MAPPED to 0 to read through FLASH_ROM_READ into a 
+ * bounce buffer instead.
+ */
+#ifndef UPGRADE_FLASH_MAPPED
+#define UPGRADE_FLASH_MAPPED	1
+#endif
+#if UPGRADE_FLASH_MAPPED
+#define UPGRADE_FLASH_BOUNCE(name, len)	uint8_t *name = NULL
+#else
+#define UPGRADE_FLASH_BOUNCE(name, len)	uint8_t name[ALIGN_4(len)]
+#endif
+
+/**
+ *	@brief get code flash for reading
+ *	@param bounce	buffer the data is read to if flash isn't mapped
+ *	@return pointer to "len" bytes of flash at "addr"
+ */
+static inline const uint8_t *upgrade_flash_map(uint32_t addr, uint8_t *bounce, 
+	uint32_t len)
+{
+#if UPGRADE_FLASH_MAPPED
+	return (const uint8_t *)(uintptr_t)addr;
+#else
+	FLASH_ROM_READ(addr, bounce, len);
+	return bounce;
+#endif
+}
+
 
 static upgrade_ctx_t ctx;
 static uint16_t upgrade_magic[4] = {0x4367U, 0x6366U, 0x426FU, 0x6F74U};
 static uint8_t magic_cnt = 0;
+static void upgrade_exec_opt(upgrade_opt_t opt_code);
+
+static int upgrade_buf_find(mb_reg_addr_t addr){
+	int i;
+	for (i = 0; i < MB_REG_DATA_BUF_NUM; i++){
+		if (addr >= upgrade_bufs[i].len_h && addr < upgrade_bufs[i].end){
+			return i;
+		}
+	}
+	return -1;
+}
+static int upgrade_buf_of_opt(uint16_t opt_code){
+	int i;
+	for (i = 0; i < MB_REG_DATA_BUF_NUM; i++){
+		if (opt_code == upgrade_bufs[i].opt_code){
+			return i;
+		}
+	}
+	return -1;
+}
+static int upgrade_buf_busy(int idx){
+	return modbus_reg_get(MB_REG_ADDR_BUF_STATE) & MB_REG_BUF_S_BUSY(idx);
+}
+static void upgrade_buf_set(int idx, uint16_t bits){
+	uint16_t state = modbus_reg_get(MB_REG_ADDR_BUF_STATE);
+	state &= ~(MB_REG_BUF_S_BUSY(idx) | MB_REG_BUF_S_ERR(idx));
+	modbus_reg_update(MB_REG_ADDR_BUF_STATE, state | bits);
+}
+/**
+ *	@brief check if a flash operation can be queued behind the running one
+ *	@param opt_code	operation written to MB_REG_ADDR_OPT_CTRL
+ *	@return 1 - queue it, 0 - reject
+ */
+static int upgrade_can_queue(uint16_t opt_code){
+	int idx = upgrade_buf_of_opt(opt_code);
+	if (idx < 0 || ctx.flag_pending || upgrade_buf_busy(idx)){
+		return 0;
+	}
+	return upgrade_buf_of_opt(ctx.opt_code) >= 0;
+}
 int8_t mb_reg_after_write(mb_reg_addr_t addr, uint16_t value){
+	int buf_idx = -1;
 	switch(addr){
 		case MB_REG_ADDR_OPT_CTRL:
 			if (ctx.status == UPGRADE_S_INIT || ctx.status == UPGRADE_S_IDLE){
 				ctx.flag_opt = 1;
+			}else if (upgrade_can_queue(value)){
+				buf_idx = upgrade_buf_of_opt(value);
+				upgrade_buf_set(buf_idx, MB_REG_BUF_S_BUSY(buf_idx));
+				ctx.opt_pending = value;
+				ctx.flag_pending = 1;
 			}
 			break;
 		default:
@@ -119,9 +259,19 @@ int8_t mb_reg_after_write(mb_reg_addr_t addr, uint16_t value){
 	return 0;
 }
 int8_t mb_reg_before_write(mb_reg_addr_t addr, uint16_t value){
-	if(UPGRADE_S_EXEC == ctx.status){
+	int buf_idx = upgrade_buf_find(addr);
+	if (buf_idx >= 0 && upgrade_buf_busy(buf_idx)){
 		return -1;
 	}
+	// only the idle buffer and a queued flash of it are accepted meanwhile
+	if(UPGRADE_S_EXEC == ctx.status){
+		if (MB_REG_ADDR_OPT_CTRL == addr){
+			return upgrade_can_queue(value) ? 0 : -1;
+		}
+		if (buf_idx < 0){
+			return -1;
+		}
+	}
 	switch(addr){
 		case MB_REG_ADDR_BUF_START:
 			if (!ctx.flag_standby){
@@ -161,22 +311,68 @@ int8_t mb_reg_before_write(mb_reg_addr_t addr, uint16_t value){
  */
 static int upgrade_md5_verify(uint32_t addr, uint32_t len, uint8_t *app_md5){
 	MD5_CTX md5_ctx;
-	int bytes_verified = 0;
+	uint32_t bytes_verified = 0;
 	uint32_t bytes_read = 0;
-	uint8_t buf[EEPROM_PAGE_SIZE];
+	UPGRADE_FLASH_BOUNCE(buf, EEPROM_PAGE_SIZE);
 	uint8_t md5[16] = {0};
 	MD5Init(&md5_ctx);
 	while(bytes_verified < len){
-		bytes_read = min(EEPROM_PAGE_SIZE, len - bytes_verified);
-		FLASH_ROM_READ(addr + bytes_verified, buf, bytes_read);
-		MD5Update(&md5_ctx, buf, bytes_read);
+		bytes_read = MIN(EEPROM_PAGE_SIZE, len - bytes_verified);
+		MD5Update(&md5_ctx, 
+			upgrade_flash_map(addr + bytes_verified, buf, bytes_read), 
+			bytes_read);
 		bytes_verified += bytes_read;
 	}
 	MD5Final(md5, &md5_ctx);
 	return memcmp(md5, app_md5, 16);
 }
-#define APP_VERIFY(size, md5)	upgrade_md5_verify(APP_ADDR_START, size, md5)
-#define BACKUP_VERIFY(size, md5)	upgrade_md5_verify(BACKUP_ADDR_START, size, md5)
+
+/**
+ *	@brief key of a verified image in the boot verification record
+ *	@return crc16 of version, size and md5, never 0
+ */
+static uint16_t upgrade_image_key(uint32_t version, uint32_t size, 
+	const uint8_t *md5)
+{
+	uint8_t buf[24];
+	uint16_t key = 0;
+	memcpy(buf, &version, 4);
+	memcpy(buf + 4, &size, 4);
+	memcpy(buf + 8, md5, 16);
+	key = crc16(buf, sizeof(buf));
+	return key ? key : 1;
+}
+#define APP_KEY()	upgrade_image_key(ctx.otainfo.app_version, \
+	ctx.otainfo.app_size, ctx.otainfo.app_md5)
+#define OTA_KEY()	upgrade_image_key(ctx.otainfo.ota_version, \
+	ctx.otainfo.ota_size, ctx.otainfo.ota_md5)
+
+/**
+ *	@brief check an image, the md5 is only computed if the boot record 
+ *	doesn't match it or a full check is requested
+ *	@param key	key in the boot record, updated with the result
+ *	@return 0 - success, (!0) - failure
+ */
+static int upgrade_boot_verify(uint32_t addr, uint32_t len, uint8_t *md5, 
+	uint16_t image_key, uint16_t *key, uint8_t full)
+{
+	if (!full && *key == image_key){
+		return 0;
+	}
+	PRINT("verify %08X ...\r\n", (unsigned int)addr);
+	if (upgrade_md5_verify(addr, len, md5)){
+		*key = 0;
+		return -1;
+	}
+	*key = image_key;
+	return 0;
+}
+#define APP_VERIFY(full)	upgrade_boot_verify(APP_ADDR_START, \
+	ctx.otainfo.app_size, ctx.otainfo.app_md5, APP_KEY(), \
+	&ctx.bootinfo.app_key, full)
+#define BACKUP_VERIFY(full)	upgrade_boot_verify(BACKUP_ADDR_START, \
+	ctx.otainfo.ota_size, ctx.otainfo.ota_md5, OTA_KEY(), \
+	&ctx.bootinfo.ota_key, full)
 
 static int upgrade_is_image_valid(appinfo_t *img_info){
 	if (APP_MAGIC != img_info->magic){
@@ -193,79 +389,44 @@ static int upgrade_is_image_valid(appinfo_t *img_info){
 fail:
 	return 0;
 }
-static int upgrade_copy_app(){
-	uint8_t buf[EEPROM_PAGE_SIZE];
-	uint32_t bytes_handled = 0;
-	uint32_t bytes_read = 0;
-	while(bytes_handled < ctx.otainfo.ota_size){
-		if(FLASH_ROM_ERASE(APP_ADDR_START + bytes_handled, EEPROM_PAGE_SIZE)){
-			PRINT("flash erase failed.\r\n");
-			goto fail;
-		}
-		bytes_handled += EEPROM_PAGE_SIZE;
-	}
-	bytes_handled = 0;
-	while(bytes_handled < ctx.otainfo.ota_size){
-		bytes_read = MIN(EEPROM_PAGE_SIZE, ctx.otainfo.ota_size - bytes_handled);
-		//read from backup part
-		FLASH_ROM_READ(BACKUP_ADDR_START + bytes_handled, buf, bytes_read);
-
-		//write to app part
-		if (FLASH_ROM_WRITE(APP_ADDR_START + bytes_handled, buf, bytes_read)){
-			PRINT("flash write failed.\r\n");
-			goto fail;
-		}
-		if (FLASH_ROM_VERIFY(APP_ADDR_START + bytes_handled, buf, bytes_read)){
-			PRINT("flash verify failed.\r\n");
-			goto fail;
-		}
-		bytes_handled += bytes_read;
-	}
-	ctx.otainfo.app_size = ctx.otainfo.ota_size;
-	ctx.otainfo.app_version = ctx.otainfo.ota_version;
-	memcpy(ctx.otainfo.app_md5, ctx.otainfo.ota_md5, 16);
-
-	cfg_update_ota(&ctx.otainfo);
-	return 0;
-	
-fail:
-	return -1;
-}
 static void upgrade_jumpapp(){
-	uint8_t need_copy = 0;
 	PFIC_DisableAllIRQ();
 	modbus_deinit();
-	if (ctx.otainfo.ota_version != ctx.otainfo.app_version){
-		upgrade_copy_app();
-	}
 	PRINT("jump to application ...\r\n");
 	GOTO_AP();
 }
 
 void upgrade_read_appinfo(){
-	uint8_t buf[ALIGN_4(sizeof(appinfo_t))] = {0};
-	appinfo_t *appinfo = (appinfo_t *)buf;
-	uint8_t flag_ota_update = 0;
+	UPGRADE_FLASH_BOUNCE(buf, sizeof(appinfo_t));
+	const appinfo_t *appinfo = NULL;
+	uint8_t full_check = 0;
 	cfg_get_ota(&ctx.otainfo);
-	FLASH_ROM_READ(APPINFO_ADDR, buf, sizeof(appinfo_t));
+	cfg_get_boot(&ctx.bootinfo);
+#if UPGRADE_FULL_VERIFY_BOOTS > 0
+	if (++ctx.bootinfo.boot_cnt >= UPGRADE_FULL_VERIFY_BOOTS){
+		ctx.bootinfo.boot_cnt = 0;
+		full_check = 1;
+	}
+#endif
+	appinfo = (const appinfo_t *)upgrade_flash_map(APPINFO_ADDR, buf, 
+		sizeof(appinfo_t));
 	ctx.app_available = 0;
 	ctx.backup_available = 0;
 	//app check
 	if (APP_MAGIC == appinfo->magic && 
 		appinfo->version == ctx.otainfo.app_version)
 	{
-		PRINT("verify app ...\r\n");
-		if (0 == APP_VERIFY(ctx.otainfo.app_size, ctx.otainfo.app_md5)){
-			memcpy(&ctx.appinfo, buf, sizeof(appinfo_t));
+		if (0 == APP_VERIFY(full_check)){
+			memcpy(&ctx.appinfo, appinfo, sizeof(appinfo_t));
 			ctx.app_available = 1;
 		}else{
 			PRINT("app not available\r\n");
 			ctx.otainfo.app_version = 0;
-			flag_ota_update = 1;
 		}
 	}
 	//backup check
-	FLASH_ROM_READ(BACKUP_APPINFO_ADDR, buf, sizeof(appinfo_t));
+	appinfo = (const appinfo_t *)upgrade_flash_map(BACKUP_APPINFO_ADDR, buf, 
+		sizeof(appinfo_t));
 	if (APP_MAGIC == appinfo->magic && 
 		appinfo->version == ctx.otainfo.ota_version)
 	{
@@ -273,50 +434,332 @@ void upgrade_read_appinfo(){
 			(appinfo->vid == ctx.appinfo.vid && 
 			appinfo->pid == ctx.appinfo.pid))
 		{
-			PRINT("verify backup app ...\r\n");
-			if (0 == BACKUP_VERIFY(ctx.otainfo.ota_size, ctx.otainfo.ota_md5)){
-				memcpy(&ctx.backup_appinfo, buf, sizeof(appinfo_t));
+			if (0 == BACKUP_VERIFY(full_check)){
+				memcpy(&ctx.backup_appinfo, appinfo, sizeof(appinfo_t));
 				ctx.backup_available = 1;
 			}else{
 				PRINT("backup app not available\r\n");
 				ctx.otainfo.ota_version = 0;
-				flag_ota_update = 1;
 			}
 		}else{
 			PRINT("backup app not available\r\n");
 			ctx.otainfo.ota_version = 0;
-			flag_ota_update = 1;
+			ctx.bootinfo.ota_key = 0;
+		}
+	}
+	// only the changed items are saved
+	cfg_update(NULL, NULL, &ctx.otainfo, &ctx.bootinfo, NULL);
+}
+/**
+ * @brief A new image is going to overwrite the backup part, restart the 
+ * hash and forget that the old one was verified.
+ */
+static void upgrade_image_begin(){
+	cfg_copy_t journal = {0};
+	MD5Init(&ctx.md5_ctx);
+	ctx.bytes_hashed = 0;
+	ctx.bytes_write = 0;
+	ctx.backup_available = 0;
+	//a copy of the old image can't be resumed from the new one either
+	ctx.bootinfo.ota_key = 0;
+	cfg_update(NULL, NULL, NULL, &ctx.bootinfo, &journal);
+}
+void upgrade_opt_finish(upgrade_opt_err_t err){
+	int pending_idx = -1;
+	if (UPGRADE_S_EXEC == ctx.status && upgrade_buf_of_opt(ctx.opt_code) >= 0){
+		upgrade_buf_set(ctx.opt_ctx.flash.buf_idx, 
+			err ? MB_REG_BUF_S_ERR(ctx.opt_ctx.flash.buf_idx) : 0);
+	}
+	modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_FINISH);
+	modbus_reg_update(MB_REG_ADDR_OPT_ERR, err);
+	ctx.status = UPGRADE_S_IDLE;
+	// the queued flash is started by upgrade_run, this may be called with 
+	// irqs off
+	if (ctx.flag_pending && UPGRADE_OPT_OK != err){
+		ctx.flag_pending = 0;
+		//data of the queued buffer follows the failed one, drop it
+		pending_idx = upgrade_buf_of_opt(ctx.opt_pending);
+		upgrade_buf_set(pending_idx, MB_REG_BUF_S_ERR(pending_idx));
+	}
+}
+
+static ModbusErrorInfo upgrade_parse_write(ModbusSlave *slave, 
+	uint8_t function, const uint8_t *pdu, uint8_t pdu_len)
+{
+	upgrade_stream_ctx_t *stream = &ctx.stream;
+	upgrade_stream_chunk_t *chunk = NULL;
+	appinfo_t appinfo;
+	uint32_t offset = 0;
+	uint8_t len = 0;
+	if (pdu_len < UPGRADE_STREAM_HEADER_LEN){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+	}
+	offset = ((uint32_t)modbusRBE(&pdu[1]) << 16) | modbusRBE(&pdu[3]);
+	len = pdu[5];
+	if (!len || len > UPGRADE_STREAM_DATA_MAX || 
+		len != pdu_len - UPGRADE_STREAM_HEADER_LEN || 
+		(offset & 0x03) || offset + len > BACKUP_PART_SIZE || 
+		crc16((uint8_t *)&pdu[UPGRADE_STREAM_HEADER_LEN], len) != modbusRBE(&pdu[6]))
+	{
+		return modbusBuildException(slave, function, MODBUS_EXCEP_ILLEGAL_VALUE);
+	}
+	if (!ctx.flag_standby){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_SLAVE_FAILURE);
+	}
+	if (UPGRADE_S_EXEC == ctx.status){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_BUSY);
+	}
+	if (0 == offset){
+		if (stream->cnt){
+			return modbusBuildException(slave, function, MODBUS_EXCEP_BUSY);
+		}
+		// the first frame must carry the whole appinfo
+		if (len < APPINFO_OFFSET + sizeof(appinfo_t)){
+			modbus_reg_update(MB_REG_ADDR_OPT_ERR, UPGRADE_OPT_ERR_INVALID_IMAGE);
+			return modbusBuildException(slave, function, MODBUS_EXCEP_SLAVE_FAILURE);
 		}
+		memcpy(&appinfo, &pdu[UPGRADE_STREAM_HEADER_LEN + APPINFO_OFFSET], 
+			sizeof(appinfo_t));
+		if (!upgrade_is_image_valid(&appinfo)){
+			modbus_reg_update(MB_REG_ADDR_OPT_ERR, UPGRADE_OPT_ERR_INVALID_IMAGE);
+			return modbusBuildException(slave, function, MODBUS_EXCEP_SLAVE_FAILURE);
+		}
+		memset(stream, 0, sizeof(upgrade_stream_ctx_t));
+		upgrade_image_begin();
+		ctx.image_size = 0;
+		modbus_reg_update(MB_REG_ADDR_OPT_CODE, UPGRADE_OPT_FLASH);
+		modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_EXEC);
+		modbus_reg_update(MB_REG_ADDR_OPT_ERR, UPGRADE_OPT_OK);
+		display_printline(DISPLAY_LAST_LINE, "Recving ...");
+	}else if (offset + len <= stream->bytes_recv){
+		// sent again after a lost response, it's queued already
+		goto resp;
+	}else if (offset != stream->bytes_recv){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_ILLEGAL_ADDRESS);
+	}
+	if (stream->err){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_SLAVE_FAILURE);
+	}
+	if (stream->cnt >= UPGRADE_STREAM_SLOTS){
+		return modbusBuildException(slave, function, MODBUS_EXCEP_BUSY);
+	}
+	chunk = &stream->chunk[(stream->head + stream->cnt) % UPGRADE_STREAM_SLOTS];
+	chunk->offset = offset;
+	chunk->len = len;
+	memcpy(chunk->data, &pdu[UPGRADE_STREAM_HEADER_LEN], len);
+	stream->cnt ++;
+	stream->bytes_recv = offset + len;
+resp:
+	if (modbusSlaveAllocateResponse(slave, 6)){
+		return MODBUS_GENERAL_ERROR(ALLOC);
+	}
+	memcpy(slave->response.pdu, pdu, 6);
+	return MODBUS_NO_ERROR();
+}
+
+/**
+ * @brief Flash the oldest queued chunk, erasing the block in front of it 
+ * first. Does one flash operation per call.
+ */
+static void upgrade_stream_next(){
+	upgrade_stream_ctx_t *stream = &ctx.stream;
+	upgrade_stream_chunk_t *chunk = &stream->chunk[stream->head];
+	uint32_t addr = BACKUP_ADDR_START + chunk->offset;
+	uint16_t len = ALIGN_4(chunk->len);
+	uint32_t irq = 0;
+	uint8_t ret = 0;
+	if (chunk->offset + chunk->len > stream->bytes_erased){
+		// a block erase keeps irqs off longer than the TX FIFO lasts
+		if (modbus_is_sending()){
+			return;
+		}
+		SYS_DisableAllIrq(&irq);
+		ret = FLASH_ROM_ERASE(BACKUP_ADDR_START + stream->bytes_erased, 
+			EEPROM_BLOCK_SIZE);
+		SYS_RecoverIrq(irq);
+		if (ret){
+			stream->err = UPGRADE_OPT_ERR_ERASE;
+			goto fail;
+		}
+		stream->bytes_erased += EEPROM_BLOCK_SIZE;
+		return;
+	}
+	memset(chunk->data + chunk->len, 0xff, len - chunk->len);
+	SYS_DisableAllIrq(&irq);
+	ret = FLASH_ROM_WRITE(addr, chunk->data, len);
+	if (!ret && FLASH_ROM_VERIFY(addr, chunk->data, len)){
+		ret = UPGRADE_OPT_ERR_VERIFY;
+	}else if (ret){
+		ret = UPGRADE_OPT_ERR_FLASH;
+	}
+	SYS_RecoverIrq(irq);
+	if (ret){
+		stream->err = ret;
+		goto fail;
+	}
+	if ((chunk->offset ^ (chunk->offset + chunk->len)) / EEPROM_BLOCK_SIZE){
+		display_printline(DISPLAY_LAST_LINE, "Recv:%uKB", 
+			(chunk->offset + chunk->len) / 1024);
+	}
+	MD5Update(&ctx.md5_ctx, chunk->data, chunk->len);
+	ctx.bytes_hashed += chunk->len;
+	ctx.bytes_write = chunk->offset + chunk->len;
+	ctx.image_size = ctx.bytes_write;
+	stream->head = (stream->head + 1) % UPGRADE_STREAM_SLOTS;
+	stream->cnt --;
+	if (!stream->cnt){
+		modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_FINISH);
+	}
+	return;
+fail:
+	stream->cnt = 0;
+	upgrade_opt_finish(stream->err);
+}
+
+static void upgrade_update_app_regs(){
+	modbus_reg_update(MB_REG_ADDR_APP_VID, ctx.appinfo.vid);
+	modbus_reg_update(MB_REG_ADDR_APP_PID, ctx.appinfo.pid);
+	modbus_reg_update(MB_REG_ADDR_APP_VERSION_H, ctx.appinfo.version >> 16);
+	modbus_reg_update(MB_REG_ADDR_APP_VERSION_L, ctx.appinfo.version);
+}
+
+/**
+ * @brief Start copying the backup image to the app part. The app key is 
+ * cleared and the journal is saved before the app part is touched, a copy 
+ * of the same image cut off by a reset is resumed from its last complete 
+ * block.
+ * @param bytes_copied	block aligned offset to resume from
+ */
+static void upgrade_copy_start(uint32_t bytes_copied){
+	upgrade_copy_ctx_t *copy = &ctx.opt_ctx.copy;
+	memset(copy, 0, sizeof(upgrade_copy_ctx_t));
+	copy->journal.ota_key = OTA_KEY();
+	copy->journal.ota_size = ctx.otainfo.ota_size;
+	copy->journal.bytes_copied = bytes_copied;
+	copy->bytes_erased = bytes_copied;
+	ctx.status = UPGRADE_S_EXEC;
+	ctx.opt_code = UPGRADE_OPT_COPY;
+	ctx.app_available = 0;
+	modbus_reg_update(MB_REG_ADDR_OPT_CODE, UPGRADE_OPT_COPY);
+	modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_EXEC);
+	modbus_reg_update(MB_REG_ADDR_OPT_PROGRESS, 0);
+	//the app part is no longer the verified image once it's erased
+	ctx.bootinfo.app_key = 0;
+	if (cfg_update(NULL, NULL, NULL, &ctx.bootinfo, &copy->journal) < 0){
+		PRINT("fail to save copy journal.\r\n");
+	}
+	PRINT("copy app from %u ...\r\n", (unsigned int)bytes_copied);
+	display_printline(DISPLAY_LAST_LINE, "Installing ...");
+}
+
+static void upgrade_copy_finish(){
+	cfg_copy_t journal = {0};
+	ctx.otainfo.app_size = ctx.otainfo.ota_size;
+	ctx.otainfo.app_version = ctx.otainfo.ota_version;
+	memcpy(ctx.otainfo.app_md5, ctx.otainfo.ota_md5, 16);
+	//every page is verified against the backup part
+	ctx.bootinfo.app_key = ctx.bootinfo.ota_key;
+	cfg_update(NULL, NULL, &ctx.otainfo, &ctx.bootinfo, &journal);
+	memcpy(&ctx.appinfo, &ctx.backup_appinfo, sizeof(appinfo_t));
+	ctx.app_available = 1;
+	upgrade_update_app_regs();
+	upgrade_opt_finish(UPGRADE_OPT_OK);
+	display_printline(DISPLAY_LAST_LINE, "Install finish");
+}
+
+/**
+ * @brief Copy the backup image to the app part, one block erase or one page 
+ * write per call. Irqs are only disabled around each flash operation and 
+ * the journal is updated after every complete block.
+ */
+static void upgrade_copy_next(){
+	upgrade_copy_ctx_t *copy = &ctx.opt_ctx.copy;
+	uint8_t buf[EEPROM_PAGE_SIZE];
+	uint32_t addr = copy->journal.bytes_copied;
+	uint32_t len = MIN(EEPROM_PAGE_SIZE, copy->journal.ota_size - addr);
+	uint32_t irq = 0;
+	uint16_t progress = 0;
+	uint8_t ret = 0;
+	if (addr >= copy->journal.ota_size){
+		upgrade_copy_finish();
+		return;
+	}
+	if (addr >= copy->bytes_erased){
+		// a block erase keeps irqs off longer than the TX FIFO lasts
+		if (modbus_is_sending()){
+			return;
+		}
+		SYS_DisableAllIrq(&irq);
+		ret = FLASH_ROM_ERASE(APP_ADDR_START + copy->bytes_erased, 
+			EEPROM_BLOCK_SIZE);
+		SYS_RecoverIrq(irq);
+		if (ret){
+			ret = UPGRADE_OPT_ERR_ERASE;
+			goto fail;
+		}
+		copy->bytes_erased += EEPROM_BLOCK_SIZE;
+		return;
+	}
+	//the data has to be in RAM as flash can't be read while it's programmed
+	FLASH_ROM_READ(BACKUP_ADDR_START + addr, buf, len);
+	SYS_DisableAllIrq(&irq);
+	ret = FLASH_ROM_WRITE(APP_ADDR_START + addr, buf, len);
+	if (!ret && FLASH_ROM_VERIFY(APP_ADDR_START + addr, buf, len)){
+		ret = UPGRADE_OPT_ERR_VERIFY;
+	}else if (ret){
+		ret = UPGRADE_OPT_ERR_FLASH;
+	}
+	SYS_RecoverIrq(irq);
+	if (ret){
+		goto fail;
 	}
-	if (flag_ota_update){
-		cfg_update_ota(&ctx.otainfo);
+	copy->journal.bytes_copied += len;
+	if (0 == copy->journal.bytes_copied % EEPROM_BLOCK_SIZE){
+		cfg_update_copy(&copy->journal);
 	}
+	progress = copy->journal.bytes_copied * 100 / copy->journal.ota_size;
+	if (progress - copy->progress >= 5){
+		copy->progress = progress;
+		modbus_reg_update(MB_REG_ADDR_OPT_PROGRESS, progress);
+		display_printline(DISPLAY_LAST_LINE, "Install: %d%%", progress);
+	}
+	return;
+fail:
+	//the journal is kept, next reset tries again. wait for the master meanwhile
+	upgrade_opt_finish(ret);
+	ctx.flag_standby = 1;
+	modbus_reg_update(MB_REG_ADDR_STANDBY, 1);
+	display_printline(DISPLAY_LAST_LINE, "Install failed");
 }
+
 void upgrade_init(){
+	cfg_copy_t journal = {0};
 	uint8_t uid[16] = {0};
 	mb_callback_t mb_cb = {mb_reg_before_write, mb_reg_after_write, NULL, NULL};
 	memset(&ctx, 0, sizeof(upgrade_ctx_t));
 	ctx.lasttime = worktime_get();
 	modbus_init(&mb_cb);
+	modbus_add_function(UPGRADE_FUNC_WRITE, upgrade_parse_write);
 	modbus_reg_update(MB_REG_ADDR_BLOCK_NUM, APP_BLOCK_NUM);
 	modbus_reg_update(MB_REG_ADDR_APP_STATE, MB_REG_APP_STATE_BOOT);
 	
 	upgrade_read_appinfo();
+	cfg_get_copy(&journal);
 	if (ctx.backup_available && (!ctx.app_available || 
 		ctx.backup_appinfo.version != ctx.appinfo.version ||
 		memcmp(ctx.otainfo.app_md5, ctx.otainfo.ota_md5, 16)))
 	{
-		PRINT("copy app ...\r\n");
-		if (0 == upgrade_copy_app()){
-			ctx.app_available = 1;
-			memcpy(&ctx.appinfo, &ctx.backup_appinfo, sizeof(appinfo_t));
+		if (journal.ota_key == OTA_KEY()){
+			upgrade_copy_start(journal.bytes_copied);
+		}else{
+			upgrade_copy_start(0);
 		}
+	}else if (journal.ota_key){
+		memset(&journal, 0, sizeof(cfg_copy_t));
+		cfg_update_copy(&journal);
 	}
 	if (ctx.app_available){
-		modbus_reg_update(MB_REG_ADDR_APP_VID, ctx.appinfo.vid);
-		modbus_reg_update(MB_REG_ADDR_APP_PID, ctx.appinfo.pid);
-		modbus_reg_update(MB_REG_ADDR_APP_VERSION_H, ctx.appinfo.version >> 16);
-		modbus_reg_update(MB_REG_ADDR_APP_VERSION_L, ctx.appinfo.version);
+		upgrade_update_app_regs();
 	}
 	modbus_reg_update(MB_REG_ADDR_BLOCK_SIZE, EEPROM_BLOCK_SIZE);
 	modbus_reg_update(MB_REG_ADDR_BUF_LEN_H, MB_REG_DATA_BUF_SIZE >> 16);
@@ -324,20 +767,17 @@ void upgrade_init(){
 	modbus_reg_update_uid(get_uid(), UID_LENGTH);
 }
 
-void upgrade_opt_finish(upgrade_opt_err_t err){
-	modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_FINISH);
-	modbus_reg_update(MB_REG_ADDR_OPT_ERR, err);
-	ctx.status = UPGRADE_S_IDLE;
-}
-
-void upgrade_flash_start(){
+void upgrade_flash_start(uint8_t buf_idx){
 	uint16_t crc = 0;
 	appinfo_t *appinfo = NULL;
-	modbus_reg_update(MB_REG_ADDR_OPT_CODE, UPGRADE_OPT_FLASH);
+	const upgrade_buf_t *buf = &upgrade_bufs[buf_idx];
+	modbus_reg_update(MB_REG_ADDR_OPT_CODE, buf->opt_code);
 	modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_EXEC);
-	ctx.opt_ctx.flash.len = modbus_reg_get(MB_REG_ADDR_DATA_LEN_H);
+	ctx.opt_ctx.flash.buf_idx = buf_idx;
+	upgrade_buf_set(buf_idx, MB_REG_BUF_S_BUSY(buf_idx));
+	ctx.opt_ctx.flash.len = modbus_reg_get(buf->len_h);
 	ctx.opt_ctx.flash.len <<= 16;
-	ctx.opt_ctx.flash.len += modbus_reg_get(MB_REG_ADDR_DATA_LEN_L);
+	ctx.opt_ctx.flash.len += modbus_reg_get(buf->len_l);
 	if (ctx.opt_ctx.flash.len <= 0){
 		upgrade_opt_finish(UPGRADE_OPT_OK);
 		return;
@@ -347,8 +787,8 @@ void upgrade_flash_start(){
 		return;
 	}
 	ctx.opt_ctx.flash.addr = BACKUP_ADDR_START + ctx.bytes_write;
-	ctx.opt_ctx.flash.data_crc = modbus_reg_get(MB_REG_ADDR_DATA_CRC);
-	ctx.opt_ctx.flash.data_buf = modbus_reg_buf_addr(MB_REG_ADDR_BUF_START);
+	ctx.opt_ctx.flash.data_crc = modbus_reg_get(buf->crc);
+	ctx.opt_ctx.flash.data_buf = modbus_reg_buf_addr(buf->start);
 	crc = crc16(ctx.opt_ctx.flash.data_buf, ctx.opt_ctx.flash.len);
 	if (crc != ctx.opt_ctx.flash.data_crc)
 	{
@@ -366,6 +806,7 @@ void upgrade_flash_start(){
 	}
 	ctx.opt_ctx.flash.bytes_write = 0;
 	crc16_init(&ctx.opt_ctx.flash.flash_crc_ctx);
+	memcpy(&ctx.opt_ctx.flash.md5_ctx, &ctx.md5_ctx, sizeof(MD5_CTX));
 }
 
 void upgrade_flash_next(){
@@ -397,6 +838,7 @@ void upgrade_flash_next(){
 	}
 	
 	crc16_update(&ctx.opt_ctx.flash.flash_crc_ctx, buf, bytes_write);
+	MD5Update(&ctx.opt_ctx.flash.md5_ctx, buf, bytes_write);
 	ctx.opt_ctx.flash.bytes_write += bytes_write;
 	
 	if (ctx.opt_ctx.flash.bytes_write >= ctx.opt_ctx.flash.len){
@@ -406,6 +848,8 @@ void upgrade_flash_next(){
 			upgrade_opt_finish(UPGRADE_OPT_ERR_VERIFY);
 			return;
 		}
+		memcpy(&ctx.md5_ctx, &ctx.opt_ctx.flash.md5_ctx, sizeof(MD5_CTX));
+		ctx.bytes_hashed += ctx.opt_ctx.flash.len;
 		ctx.bytes_write += ctx.opt_ctx.flash.len;
 		progress = ctx.bytes_write * 100 / ctx.image_size;
 		display_printline(DISPLAY_LAST_LINE, "Recv:%u%%", progress);
@@ -425,21 +869,48 @@ int upgrade_erase_start(){
 	image_size += modbus_reg_get(MB_REG_ADDR_DATA_LEN_L);
 	if (image_size > BACKUP_PART_SIZE){
 		upgrade_opt_finish(UPGRADE_OPT_ERR_INVALID_LEN);
+		return -1;
 	}
 	ctx.image_size = image_size;
-	ctx.bytes_write = 0;
+	upgrade_image_begin();
 	display_printline(DISPLAY_LAST_LINE, "Eraseing ...");
 	return 0;
 }
 
+static int upgrade_verify_finish(const uint8_t *md5){
+	UPGRADE_FLASH_BOUNCE(buf, sizeof(appinfo_t));
+	const appinfo_t *appinfo = NULL;
+	if (memcmp(md5, ctx.opt_ctx.verify.image_md5, 16)){
+		upgrade_opt_finish(UPGRADE_OPT_ERR_VERIFY);
+		return -1;
+	}
+	appinfo = (const appinfo_t *)upgrade_flash_map(BACKUP_APPINFO_ADDR, buf, 
+		sizeof(appinfo_t));
+	ctx.otainfo.ota_size = ctx.image_size;
+	ctx.otainfo.ota_version = appinfo->version;
+	memcpy(ctx.otainfo.ota_md5, md5, 16);
+	ctx.bootinfo.ota_key = OTA_KEY();
+	cfg_update(NULL, NULL, &ctx.otainfo, &ctx.bootinfo, NULL);
+	upgrade_opt_finish(UPGRADE_OPT_OK);
+	display_printline(DISPLAY_LAST_LINE, "Verify finish");
+	return 0;
+}
+
 int upgrade_verify_start(){
+	uint8_t md5[16] = {0};
 	memset(&ctx.opt_ctx.verify, 0, sizeof(upgrade_verify_ctx_t));
 	const uint8_t *data_buf = modbus_reg_buf_addr(MB_REG_ADDR_BUF_START);
 	memcpy(ctx.opt_ctx.verify.image_md5, data_buf, 16);
-	MD5Init(&ctx.opt_ctx.verify.md5_ctx);
 	modbus_reg_update(MB_REG_ADDR_OPT_CODE, UPGRADE_OPT_VERIFY);
 	modbus_reg_update(MB_REG_ADDR_OPT_STATE, UPGRADE_OPT_S_EXEC);
 	modbus_reg_update(MB_REG_ADDR_OPT_PROGRESS, ctx.opt_ctx.verify.progress);
+	// the whole image was hashed while it was flashed, no need to read it back
+	if (ctx.image_size && ctx.bytes_hashed == ctx.image_size){
+		memcpy(&ctx.opt_ctx.verify.md5_ctx, &ctx.md5_ctx, sizeof(MD5_CTX));
+		MD5Final(md5, &ctx.opt_ctx.verify.md5_ctx);
+		return upgrade_verify_finish(md5);
+	}
+	MD5Init(&ctx.opt_ctx.verify.md5_ctx);
 	display_printline(DISPLAY_LAST_LINE, "Verifing ...");
 	return 0;
 }
@@ -469,42 +940,40 @@ void upgrade_erase_next(){
 }
 
 static int upgrade_verify_next(){
-	uint8_t buf[EEPROM_PAGE_SIZE] = {0};
+	UPGRADE_FLASH_BOUNCE(buf, EEPROM_PAGE_SIZE);
 	upgrade_verify_ctx_t *verify_ctx = &ctx.opt_ctx.verify;
 	int bytes_remain = ctx.image_size - verify_ctx->bytes_verified;
 	int bytes_read = MIN(EEPROM_PAGE_SIZE, bytes_remain);
-	FLASH_ROM_READ(BACKUP_ADDR_START + verify_ctx->bytes_verified, 
-		(void *)buf, bytes_read);
-	MD5Update(&verify_ctx->md5_ctx, buf, bytes_read);
+	MD5Update(&verify_ctx->md5_ctx, 
+		upgrade_flash_map(BACKUP_ADDR_START + verify_ctx->bytes_verified, 
+		buf, bytes_read), bytes_read);
 	verify_ctx->bytes_verified += bytes_read;
 	if (verify_ctx->bytes_verified >= ctx.image_size){
 		uint8_t md5[16] = {0};
-		appinfo_t *appinfo = (appinfo_t *)buf;
 		MD5Final(md5, &verify_ctx->md5_ctx);
-		if (memcmp(md5, verify_ctx->image_md5, 16)){
-			upgrade_opt_finish(UPGRADE_OPT_ERR_VERIFY);
-			return -1;
-		}
-		FLASH_ROM_READ(BACKUP_APPINFO_ADDR, buf, sizeof(appinfo_t));
-		ctx.otainfo.ota_size = ctx.image_size;
-		ctx.otainfo.ota_version = appinfo->version;
-		memcpy(ctx.otainfo.ota_md5, md5, 16);
-		cfg_update_ota(&ctx.otainfo);
-		upgrade_opt_finish(UPGRADE_OPT_OK);
-		display_printline(DISPLAY_LAST_LINE, "Verify finish");
-		return 0;
+		return upgrade_verify_finish(md5);
 	}
 	return 0;
 }
 
 void upgrade_exec_next(){
 	uint32_t irq = 0;
+	// a block erase runs with irqs off far longer than the TX FIFO lasts, 
+	// wait for the response to go out so that it isn't torn apart
+	if (UPGRADE_OPT_ERASE == ctx.opt_code && modbus_is_sending()){
+		return;
+	}
+	if (UPGRADE_OPT_COPY == ctx.opt_code){
+		upgrade_copy_next();
+		return;
+	}
 	SYS_DisableAllIrq(&irq);
 	switch(ctx.opt_code){
 		case UPGRADE_OPT_ERASE:
 			upgrade_erase_next();
 			break;
 		case UPGRADE_OPT_FLASH:
+		case UPGRADE_OPT_FLASH_B:
 			upgrade_flash_next();
 			break;
 		case UPGRADE_OPT_VERIFY:
@@ -524,8 +993,7 @@ void upgrade_refresh(){
 	upgrade_read_appinfo();
 	upgrade_opt_finish(UPGRADE_OPT_OK);
 }
-void upgrade_exec_start(){
-	uint16_t opt_code = modbus_reg_get(MB_REG_ADDR_OPT_CTRL);
+static void upgrade_exec_opt(upgrade_opt_t opt_code){
 	if (UPGRADE_S_EXEC == ctx.status){
 		return;
 	}
@@ -541,7 +1009,8 @@ void upgrade_exec_start(){
 			upgrade_erase_start();
 			break;
 		case UPGRADE_OPT_FLASH:
-			upgrade_flash_start();
+		case UPGRADE_OPT_FLASH_B:
+			upgrade_flash_start(upgrade_buf_of_opt(opt_code));
 			break;
 		case UPGRADE_OPT_VERIFY:
 			upgrade_verify_start();
@@ -550,8 +1019,21 @@ void upgrade_exec_start(){
 			upgrade_opt_finish(UPGRADE_OPT_ERR_INVALID_OPT);
 			break;
 	}
+}
+void upgrade_exec_start(){
+	if (UPGRADE_S_EXEC == ctx.status){
+		return;
+	}
+	upgrade_exec_opt(modbus_reg_get(MB_REG_ADDR_OPT_CTRL));
 	ctx.flag_opt = 0;
 }
+static void upgrade_exec_pending(){
+	if (UPGRADE_S_EXEC == ctx.status){
+		return;
+	}
+	ctx.flag_pending = 0;
+	upgrade_exec_opt(ctx.opt_pending);
+}
 
 void upgrade_run(){
 	uint32_t irq = 0;
@@ -567,7 +1049,11 @@ void upgrade_run(){
 				display_printline(DISPLAY_LAST_LINE, "Standby ...");
 			}
 		case UPGRADE_S_IDLE:
-			if (ctx.flag_opt){
+			if (ctx.flag_pending){
+				upgrade_exec_pending();
+			}else if (ctx.stream.cnt){
+				upgrade_stream_next();
+			}else if (ctx.flag_opt){
 				upgrade_exec_start();
 			}else {
 				if (ctx.app_available && (!ctx.flag_standby) && 
@@ -350,4 +350,316 @@ uint32_t crc_check(crc_type_t *crc_type, const uint8_t *buffer, uint32_t length)
         return check_crc32(crc_type->poly, crc_type->init, crc_type->refin, crc_type->refout, crc_type->xor_out, buffer, length);
     }
     return 0;
-}
\ No newline at end of file
+}
+/*
+ * Reflected CRCs are kept reflected in the low bits of the register and 
+ * shifted right, the others are kept left aligned in the 32-bit register and 
+ * shifted left, so that any width up to 32 shares the same tables layout. 
+ * Entries narrower than 32 bits drop the bits that are always zero: the high 
+ * bits of reflected entries, the low bits of left aligned ones.
+ */
+static inline __attribute__((always_inline)) uint32_t crc_entry(const void *table, 
+    uint8_t entry, bool ref, uint32_t k, uint32_t i)
+{
+    uint32_t v;
+    if (entry == 1)
+    {
+        v = ((const uint8_t (*)[256])table)[k][i];
+    }
+    else if (entry == 2)
+    {
+        v = ((const uint16_t (*)[256])table)[k][i];
+    }
+    else
+    {
+        return ((const uint32_t (*)[256])table)[k][i];
+    }
+    return ref ? v : v << (32 - 8 * entry);
+}
+
+static void crc_entry_set(crc_table_t *tab, uint32_t k, uint32_t i, uint32_t v)
+{
+    if (tab->type.refin != true)
+    {
+        v >>= 32 - 8 * tab->entry;
+    }
+    if (tab->entry == 1)
+    {
+        ((uint8_t (*)[256])tab->table)[k][i] = v;
+    }
+    else if (tab->entry == 2)
+    {
+        ((uint16_t (*)[256])tab->table)[k][i] = v;
+    }
+    else
+    {
+        ((uint32_t (*)[256])tab->table)[k][i] = v;
+    }
+}
+
+void crc_table_init(crc_table_t *tab)
+{
+    uint32_t poly;
+    uint32_t crc;
+    uint32_t i, j, k;
+    bool ref = tab->type.refin == true;
+    if (tab->ready || tab->entry < CRC_TABLE_ENTRY(tab->type.width))
+    {
+        return;
+    }
+    if (ref)
+    {
+        poly = reflected_data(tab->type.poly, REF_32BIT) >> (32 - tab->type.width);
+    }
+    else
+    {
+        poly = tab->type.poly << (32 - tab->type.width);
+    }
+    for (i = 0; i < 256; i++)
+    {
+        if (ref)
+        {
+            crc = i;
+            for (j = 0; j < 8; j++)
+            {
+                crc = (crc & 0x01) ? (crc >> 1) ^ poly : crc >> 1;
+            }
+        }
+        else
+        {
+            crc = i << 24;
+            for (j = 0; j < 8; j++)
+            {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ poly : crc << 1;
+            }
+        }
+        crc_entry_set(tab, 0, i, crc);
+    }
+    // slice k advances a byte through k more zero bytes
+    for (k = 1; k < tab->slices; k++)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            crc = crc_entry(tab->table, tab->entry, ref, k - 1, i);
+            if (ref)
+            {
+                crc = (crc >> 8) ^ crc_entry(tab->table, tab->entry, ref, 0, crc & 0xff);
+            }
+            else
+            {
+                crc = (crc << 8) ^ crc_entry(tab->table, tab->entry, ref, 0, crc >> 24);
+            }
+            crc_entry_set(tab, k, i, crc);
+        }
+    }
+    tab->ready = 1;
+}
+
+void crc_init(crc_ctx_t *ctx, crc_table_t *tab)
+{
+    crc_table_init(tab);
+    ctx->tab = tab;
+    if (tab->type.refin == true)
+    {
+        ctx->reg = reflected_data(tab->type.init, REF_32BIT) >> (32 - tab->type.width);
+    }
+    else
+    {
+        ctx->reg = tab->type.init << (32 - tab->type.width);
+    }
+}
+
+#define T(k, i) crc_entry(t, entry, true, k, i)
+static inline __attribute__((always_inline)) uint32_t crc_update_ref(const void *t, 
+    uint8_t entry, uint8_t slices, uint32_t crc, const uint8_t *buffer, uint32_t length)
+{
+    if (slices >= 8)
+    {
+        while (length >= 8)
+        {
+            crc ^= buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+            crc = T(7, crc & 0xff) ^ T(6, (crc >> 8) & 0xff) ^ 
+                T(5, (crc >> 16) & 0xff) ^ T(4, crc >> 24) ^ 
+                T(3, buffer[4]) ^ T(2, buffer[5]) ^ T(1, buffer[6]) ^ T(0, buffer[7]);
+            buffer += 8;
+            length -= 8;
+        }
+    }
+    if (slices >= 4)
+    {
+        while (length >= 4)
+        {
+            crc ^= buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+            crc = T(3, crc & 0xff) ^ T(2, (crc >> 8) & 0xff) ^ 
+                T(1, (crc >> 16) & 0xff) ^ T(0, crc >> 24);
+            buffer += 4;
+            length -= 4;
+        }
+    }
+    while (length--)
+    {
+        crc = (crc >> 8) ^ T(0, (crc ^ *buffer++) & 0xff);
+    }
+    return crc;
+}
+#undef T
+
+#define T(k, i) crc_entry(t, entry, false, k, i)
+static inline __attribute__((always_inline)) uint32_t crc_update_norm(const void *t, 
+    uint8_t entry, uint8_t slices, uint32_t crc, const uint8_t *buffer, uint32_t length)
+{
+    if (slices >= 8)
+    {
+        while (length >= 8)
+        {
+            crc ^= ((uint32_t)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+            crc = T(7, crc >> 24) ^ T(6, (crc >> 16) & 0xff) ^ 
+                T(5, (crc >> 8) & 0xff) ^ T(4, crc & 0xff) ^ 
+                T(3, buffer[4]) ^ T(2, buffer[5]) ^ T(1, buffer[6]) ^ T(0, buffer[7]);
+            buffer += 8;
+            length -= 8;
+        }
+    }
+    if (slices >= 4)
+    {
+        while (length >= 4)
+        {
+            crc ^= ((uint32_t)buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+            crc = T(3, crc >> 24) ^ T(2, (crc >> 16) & 0xff) ^ 
+                T(1, (crc >> 8) & 0xff) ^ T(0, crc & 0xff);
+            buffer += 4;
+            length -= 4;
+        }
+    }
+    while (length--)
+    {
+        crc = (crc << 8) ^ T(0, (crc >> 24) ^ *buffer++);
+    }
+    return crc;
+}
+#undef T
+
+// entries too narrow for the preset leave the table unused, run bit by bit
+static uint32_t crc_update_bits(crc_type_t *type, uint32_t crc, 
+    const uint8_t *buffer, uint32_t length)
+{
+    uint32_t poly;
+    uint32_t j;
+    if (type->refin == true)
+    {
+        poly = reflected_data(type->poly, REF_32BIT) >> (32 - type->width);
+        while (length--)
+        {
+            crc ^= *buffer++;
+            for (j = 0; j < 8; j++)
+            {
+                crc = (crc & 0x01) ? (crc >> 1) ^ poly : crc >> 1;
+            }
+        }
+    }
+    else
+    {
+        poly = type->poly << (32 - type->width);
+        while (length--)
+        {
+            crc ^= (uint32_t)*buffer++ << 24;
+            for (j = 0; j < 8; j++)
+            {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ poly : crc << 1;
+            }
+        }
+    }
+    return crc;
+}
+
+// one copy of the loops per entry size, the entry size folds into the lookups
+#define CRC_UPDATE(ref, entry) ((ref) ? \
+    crc_update_ref(tab->table, entry, tab->slices, ctx->reg, buffer, length) : \
+    crc_update_norm(tab->table, entry, tab->slices, ctx->reg, buffer, length))
+
+void crc_update(crc_ctx_t *ctx, const uint8_t *buffer, uint32_t length)
+{
+    crc_table_t *tab = ctx->tab;
+    bool ref = tab->type.refin == true;
+    if (!tab->ready)
+    {
+        ctx->reg = crc_update_bits(&tab->type, ctx->reg, buffer, length);
+    }
+    else if (tab->entry == 1)
+    {
+        ctx->reg = CRC_UPDATE(ref, 1);
+    }
+    else if (tab->entry == 2)
+    {
+        ctx->reg = CRC_UPDATE(ref, 2);
+    }
+    else
+    {
+        ctx->reg = CRC_UPDATE(ref, 4);
+    }
+}
+
+uint32_t crc_final(crc_ctx_t *ctx)
+{
+    crc_type_t *type = &ctx->tab->type;
+    uint32_t crc = ctx->reg;
+    if (type->refin != true)
+    {
+        crc >>= 32 - type->width;
+    }
+    if (type->refin != type->refout)
+    {
+        crc = reflected_data(crc, REF_32BIT) >> (32 - type->width);
+    }
+    return crc ^ type->xor_out;
+}
+
+/**
+ * @brief same result as crc_check, using the tables of "tab"
+ */
+uint32_t crc_table_check(crc_table_t *tab, const uint8_t *buffer, uint32_t length)
+{
+    crc_ctx_t ctx;
+    crc_init(&ctx, tab);
+    crc_update(&ctx, buffer, length);
+    return crc_final(&ctx);
+}
+
+// CRC-8/MAXIM, used by the storage log
+static const uint8_t crc8_maxim_data[1][256] = {
+    {
+        0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83,
+        0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41,
+        0x9D, 0xC3, 0x21, 0x7F, 0xFC, 0xA2, 0x40, 0x1E,
+        0x5F, 0x01, 0xE3, 0xBD, 0x3E, 0x60, 0x82, 0xDC,
+        0x23, 0x7D, 0x9F, 0xC1, 0x42, 0x1C, 0xFE, 0xA0,
+        0xE1, 0xBF, 0x5D, 0x03, 0x80, 0xDE, 0x3C, 0x62,
+        0xBE, 0xE0, 0x02, 0x5C, 0xDF, 0x81, 0x63, 0x3D,
+        0x7C, 0x22, 0xC0, 0x9E, 0x1D, 0x43, 0xA1, 0xFF,
+        0x46, 0x18, 0xFA, 0xA4, 0x27, 0x79, 0x9B, 0xC5,
+        0x84, 0xDA, 0x38, 0x66, 0xE5, 0xBB, 0x59, 0x07,
+        0xDB, 0x85, 0x67, 0x39, 0xBA, 0xE4, 0x06, 0x58,
+        0x19, 0x47, 0xA5, 0xFB, 0x78, 0x26, 0xC4, 0x9A,
+        0x65, 0x3B, 0xD9, 0x87, 0x04, 0x5A, 0xB8, 0xE6,
+        0xA7, 0xF9, 0x1B, 0x45, 0xC6, 0x98, 0x7A, 0x24,
+        0xF8, 0xA6, 0x44, 0x1A, 0x99, 0xC7, 0x25, 0x7B,
+        0x3A, 0x64, 0x86, 0xD8, 0x5B, 0x05, 0xE7, 0xB9,
+        0x8C, 0xD2, 0x30, 0x6E, 0xED, 0xB3, 0x51, 0x0F,
+        0x4E, 0x10, 0xF2, 0xAC, 0x2F, 0x71, 0x93, 0xCD,
+        0x11, 0x4F, 0xAD, 0xF3, 0x70, 0x2E, 0xCC, 0x92,
+        0xD3, 0x8D, 0x6F, 0x31, 0xB2, 0xEC, 0x0E, 0x50,
+        0xAF, 0xF1, 0x13, 0x4D, 0xCE, 0x90, 0x72, 0x2C,
+        0x6D, 0x33, 0xD1, 0x8F, 0x0C, 0x52, 0xB0, 0xEE,
+        0x32, 0x6C, 0x8E, 0xD0, 0x53, 0x0D, 0xEF, 0xB1,
+        0xF0, 0xAE, 0x4C, 0x12, 0x91, 0xCF, 0x2D, 0x73,
+        0xCA, 0x94, 0x76, 0x28, 0xAB, 0xF5, 0x17, 0x49,
+        0x08, 0x56, 0xB4, 0xEA, 0x69, 0x37, 0xD5, 0x8B,
+        0x57, 0x09, 0xEB, 0xB5, 0x36, 0x68, 0x8A, 0xD4,
+        0x95, 0xCB, 0x29, 0x77, 0xF4, 0xAA, 0x48, 0x16,
+        0xE9, 0xB7, 0x55, 0x0B, 0x88, 0xD6, 0x34, 0x6A,
+        0x2B, 0x75, 0x97, 0xC9, 0x4A, 0x14, 0xF6, 0xA8,
+        0x74, 0x2A, 0xC8, 0x96, 0x15, 0x4B, 0xA9, 0xF7,
+        0xB6, 0xE8, 0x0A, 0x54, 0xD7, 0x89, 0x6B, 0x35,
+    }
+};
+crc_table_t crc8_maxim_table = CRC_TABLE_CONST(CRC8_MAXIM_INIT, 8, 1, crc8_maxim_data);
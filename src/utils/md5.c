@@ -15,7 +15,8 @@
 #include "string.h"
 #include "utils/md5.h"
 
-static void MD5Transform(uint32_t buf[4], uint32_t const in[16]);
+static void MD5Transform(uint32_t buf[4], uint32_t const in[16], 
+	unsigned blocks);
 
 
 /**
@@ -60,7 +61,10 @@ md5_vector(size_t num_elem, const uint8_t *addr[], const size_t *len, uint8_t *m
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
 #define byteReverse(buf, len)	/* Nothing */
+/* aligned input can be transformed in place, without a copy to ctx->in */
+#define MD5_ALIGNED(p)	(0 == ((uintptr_t)(p) & 0x03))
 #else
+#define MD5_ALIGNED(p)	0
 /*
  * Note: this code is harmless on little-endian machines.
  */
@@ -122,16 +126,21 @@ MD5Update(struct MD5Context *ctx, unsigned char const *buf, unsigned len)
 	}
 	memcpy(p, buf, t);
 	byteReverse(ctx->in, 16);
-	MD5Transform(ctx->buf, (uint32_t *) ctx->in);
+	MD5Transform(ctx->buf, (uint32_t *) ctx->in, 1);
 	buf += t;
 	len -= t;
     }
     /* Process data in 64-byte chunks */
 
+    if (MD5_ALIGNED(buf) && len >= 64) {
+	MD5Transform(ctx->buf, (uint32_t const *) buf, len >> 6);
+	buf += len & ~0x3fU;
+	len &= 0x3f;
+    }
     while (len >= 64) {
 	memcpy(ctx->in, buf, 64);
 	byteReverse(ctx->in, 16);
-	MD5Transform(ctx->buf, (uint32_t *) ctx->in);
+	MD5Transform(ctx->buf, (uint32_t *) ctx->in, 1);
 	buf += 64;
 	len -= 64;
     }
@@ -167,7 +176,7 @@ MD5Final(unsigned char digest[16], struct MD5Context *ctx)
 	/* Two lots of padding:  Pad the first block to 64 bytes */
 	memset(p, 0, count);
 	byteReverse(ctx->in, 16);
-	MD5Transform(ctx->buf, (uint32_t *) ctx->in);
+	MD5Transform(ctx->buf, (uint32_t *) ctx->in, 1);
 
 	/* Now fill the next block with 56 bytes */
 	memset(ctx->in, 0, 56);
@@ -181,7 +190,7 @@ MD5Final(unsigned char digest[16], struct MD5Context *ctx)
     ((uint32_t *) ctx->in)[14] = ctx->bits[0];
     ((uint32_t *) ctx->in)[15] = ctx->bits[1];
 
-    MD5Transform(ctx->buf, (uint32_t *) ctx->in);
+    MD5Transform(ctx->buf, (uint32_t *) ctx->in, 1);
     byteReverse((unsigned char *) ctx->buf, 4);
     memcpy(digest, ctx->buf, 16);
     memset(ctx, 0, sizeof(struct MD5Context));	/* In case it's sensitive */
@@ -203,16 +212,20 @@ MD5Final(unsigned char digest[16], struct MD5Context *ctx)
  * The core of the MD5 algorithm, this alters an existing MD5 hash to
  * reflect the addition of 16 longwords of new data.  MD5Update blocks
  * the data and converts bytes into longwords for this routine.
+ * Several consecutive blocks are handled in one call, the state stays in
+ * registers between them.
  */
 static void
-MD5Transform(uint32_t buf[4], uint32_t const in[16])
+MD5Transform(uint32_t buf[4], uint32_t const in[16], unsigned blocks)
 {
     register uint32_t a, b, c, d;
+    uint32_t sa = buf[0], sb = buf[1], sc = buf[2], sd = buf[3];
 
-    a = buf[0];
-    b = buf[1];
-    c = buf[2];
-    d = buf[3];
+    do {
+    a = sa;
+    b = sb;
+    c = sc;
+    d = sd;
 
     MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7);
     MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12);
@@ -282,10 +295,17 @@ MD5Transform(uint32_t buf[4], uint32_t const in[16])
     MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15);
     MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21);
 
-    buf[0] += a;
-    buf[1] += b;
-    buf[2] += c;
-    buf[3] += d;
+    sa += a;
+    sb += b;
+    sc += c;
+    sd += d;
+    in += 16;
+    } while (--blocks);
+
+    buf[0] = sa;
+    buf[1] = sb;
+    buf[2] = sc;
+    buf[3] = sd;
 }
 /* ===== end - public domain MD5 implementation ===== */
 
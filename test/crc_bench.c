@@ -0,0 +1,200 @@
+/*
+ * CRC engine benchmark.
+ * Checks the table driven engine against the bitwise crc_check for every
+ * preset of crc.h, with known check values and random split updates, then
+ * reports the throughput of both. Exit status is non-zero if any check failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils/crc.h"
+
+#define BENCH_BUF_MAX	4096
+
+typedef struct bench_preset{
+	const char *name;
+	crc_type_t type;
+	uint32_t check;	//crc of "123456789"
+} bench_preset_t;
+
+static const bench_preset_t presets[] = {
+	{"CRC4_ITU", CRC4_ITU_INIT, 0x07},
+	{"CRC5_EPC", CRC5_EPC_INIT, 0x00},
+	{"CRC5_ITU", CRC5_ITU_INIT, 0x07},
+	{"CRC5_USB", CRC5_USB_INIT, 0x19},
+	{"CRC6_ITU", CRC6_ITU_INIT, 0x06},
+	{"CRC7_MMC", CRC7_MMC_INIT, 0x75},
+	{"CRC8", CRC8_INIT, 0xF4},
+	{"CRC8_ITU", CRC8_ITU_INIT, 0xA1},
+	{"CRC8_ROHC", CRC8_ROHC_INIT, 0xD0},
+	{"CRC8_MAXIM", CRC8_MAXIM_INIT, 0xA1},
+	{"CRC16_IBM", CRC16_IBM_INIT, 0xBB3D},
+	{"CRC16_MAXIM", CRC16_MAXIM_INIT, 0x44C2},
+	{"CRC16_USB", CRC16_USB_INIT, 0xB4C8},
+	{"CRC16_MODBUS", CRC16_MODBUS_INIT, 0x4B37},
+	{"CRC16_CCITT", CRC16_CCITT_INIT, 0x2189},
+	{"CRC16_CCITT_FALSE", CRC16_CCITT_FALSE_INIT, 0x29B1},
+	{"CRC16_X25", CRC16_X25_INIT, 0x906E},
+	{"CRC16_XMODEM", CRC16_XMODEM_INIT, 0x31C3},
+	{"CRC16_DNP", CRC16_DNP_INIT, 0xEA82},
+	{"CRC32", CRC32_INIT, 0xCBF43926},
+	{"CRC32_MPEG2", CRC32_MPEG2_INIT, 0x0376E6E7},
+};
+#define PRESET_CNT	(sizeof(presets) / sizeof(presets[0]))
+
+static const uint8_t slice_cnt[] = {1, 4, 8};
+static const uint8_t entry_size[] = {1, 2, 4};
+
+static uint32_t table_data[8][256];
+static uint8_t buf[BENCH_BUF_MAX];
+static int errors = 0;
+
+static uint64_t bench_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @param entry bytes per entry, narrower than the CRC width runs bit by bit
+ */
+static void table_setup(crc_table_t *tab, const crc_type_t *type, uint8_t slices,
+	uint8_t entry)
+{
+	tab->type = *type;
+	tab->slices = slices;
+	tab->ready = 0;
+	tab->entry = entry;
+	tab->table = table_data;
+}
+
+static void bench_verify(const bench_preset_t *preset, int rounds){
+	crc_type_t type = preset->type;
+	crc_table_t tab;
+	crc_ctx_t ctx;
+	uint32_t expect = 0, crc = 0;
+	uint32_t len = 0, split = 0;
+	int i = 0, j = 0, k = 0;
+	if (crc_check(&type, (const uint8_t *)"123456789", 9) != preset->check){
+		fprintf(stderr, "%s: bitwise check value %X, expect %X\n", preset->name,
+			crc_check(&type, (const uint8_t *)"123456789", 9), preset->check);
+		errors ++;
+	}
+	for (i = 0; i < sizeof(slice_cnt) * sizeof(entry_size); i++){
+		k = i % sizeof(entry_size);
+		table_setup(&tab, &preset->type, slice_cnt[i / sizeof(entry_size)],
+			entry_size[k]);
+		crc = crc_table_check(&tab, (const uint8_t *)"123456789", 9);
+		if (crc != preset->check){
+			fprintf(stderr, "%s/%d/%d: check value %X, expect %X\n", preset->name,
+				tab.slices, tab.entry, crc, preset->check);
+			errors ++;
+		}
+		for (j = 0; j < rounds; j++){
+			len = rand() % 600;
+			split = len ? rand() % len : 0;
+			expect = crc_check(&type, buf, len);
+			crc_init(&ctx, &tab);
+			crc_update(&ctx, buf, split);
+			crc_update(&ctx, buf + split, len - split);
+			crc = crc_final(&ctx);
+			if (crc != expect){
+				fprintf(stderr, "%s/%d/%d: len %u split %u: %X, expect %X\n",
+					preset->name, tab.slices, tab.entry, len, split, crc, expect);
+				errors ++;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * @return MB/s of "slices"(0 for bitwise crc_check) over blocks of "len"
+ */
+static double bench_speed(const crc_type_t *preset, int slices, uint32_t len){
+	crc_type_t type = *preset;
+	crc_table_t tab;
+	volatile uint32_t sink = 0;
+	uint32_t total = 0;
+	uint64_t ns = 0;
+	table_setup(&tab, preset, slices ? slices : 1, CRC_TABLE_ENTRY(preset->width));
+	crc_table_init(&tab);
+	ns = bench_ns();
+	while (total < (slices ? 64 : 8) * 1024 * 1024){
+		if (slices){
+			sink ^= crc_table_check(&tab, buf, len);
+		}else{
+			sink ^= crc_check(&type, buf, len);
+		}
+		total += len;
+	}
+	ns = bench_ns() - ns;
+	return total * 1000.0 / ns;
+}
+
+/**
+ * @brief the table kept in flash must match the generated one
+ */
+static void bench_const(int rounds){
+	crc_type_t type = CRC8_MAXIM_INIT;
+	uint32_t len = 0;
+	int i = 0;
+	for (i = 0; i < rounds; i++){
+		len = rand() % 600;
+		if (crc_table_check(&crc8_maxim_table, buf, len) != crc_check(&type, buf, len)){
+			fprintf(stderr, "crc8_maxim_table: len %u mismatch\n", len);
+			errors ++;
+			break;
+		}
+	}
+}
+
+static void usage(const char *name){
+	printf("usage: %s [-r rounds] [-s seed]\n", name);
+}
+
+int main(int argc, char **argv){
+	static const int speed_idx[] = {9, 13, 19};	//CRC8_MAXIM, CRC16_MODBUS, CRC32
+	static const uint32_t speed_len[] = {16, 248, BENCH_BUF_MAX};
+	int rounds = 200;
+	unsigned seed = 1;
+	int opt = 0;
+	int i = 0, j = 0;
+	while ((opt = getopt(argc, argv, "r:s:h")) != -1){
+		switch(opt){
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	for (i = 0; i < BENCH_BUF_MAX; i++){
+		buf[i] = rand();
+	}
+	for (i = 0; i < PRESET_CNT; i++){
+		bench_verify(&presets[i], rounds);
+	}
+	bench_const(rounds);
+	printf("%-14s %6s %10s %10s %10s %10s\n", "preset", "len", "bitwise",
+		"table", "slice4", "slice8");
+	for (i = 0; i < sizeof(speed_idx) / sizeof(speed_idx[0]); i++){
+		for (j = 0; j < sizeof(speed_len) / sizeof(speed_len[0]); j++){
+			printf("%-14s %6u %10.1f %10.1f %10.1f %10.1f\n",
+				presets[speed_idx[i]].name, speed_len[j],
+				bench_speed(&presets[speed_idx[i]].type, 0, speed_len[j]),
+				bench_speed(&presets[speed_idx[i]].type, 1, speed_len[j]),
+				bench_speed(&presets[speed_idx[i]].type, 4, speed_len[j]),
+				bench_speed(&presets[speed_idx[i]].type, 8, speed_len[j]));
+		}
+	}
+	printf("MB/s, %s, %d errors\n", errors ? "FAIL" : "PASS", errors);
+	return errors ? 1 : 0;
+}
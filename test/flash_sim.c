@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include "CH58x_common.h"
+#include "flash_sim.h"
+
+#define FLASH_SIM_SIZE	EEPROM_MAX_SIZE
+#define FLASH_SIM_UNIT_MAX	(FLASH_SIM_SIZE / EEPROM_MIN_ER_SIZE)
+
+typedef struct flash_sim_context{
+	uint8_t strict;
+	uint8_t power_cut;	//power loss armed
+	uint8_t power_lost;
+	uint32_t power_bytes;	//bytes left to program before power loss
+	uint32_t erase_size;
+	uint8_t mem[FLASH_SIM_SIZE];
+	uint32_t wear[FLASH_SIM_UNIT_MAX];
+	flash_sim_stat_t stat;
+} flash_sim_ctx_t;
+
+static flash_sim_ctx_t sim = {
+	.strict = 1,
+	.erase_size = EEPROM_MIN_ER_SIZE,
+};
+
+int host_log_enable = 0;
+
+static int flash_sim_range_valid(uint32_t addr, uint32_t len){
+	return addr < FLASH_SIM_SIZE && len <= FLASH_SIM_SIZE - addr;
+}
+
+static uint32_t flash_sim_read(uint32_t addr, uint8_t *buf, uint32_t len){
+	if (!buf || !flash_sim_range_valid(addr, len)){
+		return 1;
+	}
+	memcpy(buf, sim.mem + addr, len);
+	sim.stat.read_cnt ++;
+	sim.stat.read_bytes += len;
+	return 0;
+}
+
+static uint32_t flash_sim_write(uint32_t addr, const uint8_t *buf, uint32_t len){
+	uint32_t i = 0;
+	uint8_t violation = 0;
+	if (!buf || !len || !flash_sim_range_valid(addr, len)){
+		return 1;
+	}
+	if (sim.power_lost){
+		return 1;
+	}
+	for (i = 0; i < len; i++){
+		if ((sim.mem[addr + i] & buf[i]) != buf[i]){
+			violation = 1;
+		}
+	}
+	if (violation){
+		sim.stat.violation_cnt ++;
+		if (sim.strict){
+			return 1;
+		}
+	}
+	if (sim.power_cut && len > sim.power_bytes){
+		for (i = 0; i < sim.power_bytes; i++){
+			sim.mem[addr + i] &= buf[i];
+		}
+		sim.power_lost = 1;
+		return 1;
+	}
+	if (sim.power_cut){
+		sim.power_bytes -= len;
+	}
+	for (i = 0; i < len; i++){
+		sim.mem[addr + i] &= buf[i];
+	}
+	sim.stat.write_cnt ++;
+	sim.stat.write_bytes += len;
+	sim.stat.page_prog_cnt += (addr + len - 1) / EEPROM_PAGE_SIZE - 
+		addr / EEPROM_PAGE_SIZE + 1;
+	return 0;
+}
+
+static uint32_t flash_sim_erase(uint32_t addr, uint32_t len){
+	uint32_t unit = 0;
+	if (!len || !flash_sim_range_valid(addr, len)){
+		return 1;
+	}
+	if (addr % sim.erase_size || len % sim.erase_size){
+		return 1;
+	}
+	if (sim.power_lost){
+		return 1;
+	}
+	memset(sim.mem + addr, 0xff, len);
+	for (unit = addr / EEPROM_MIN_ER_SIZE; 
+		unit < (addr + len) / EEPROM_MIN_ER_SIZE; unit++)
+	{
+		sim.wear[unit] ++;
+	}
+	sim.stat.erase_cnt ++;
+	sim.stat.erase_bytes += len;
+	return 0;
+}
+
+uint32_t FLASH_EEPROM_CMD(uint8_t cmd, uint32_t StartAddr, void *Buffer, 
+	uint32_t Length)
+{
+	switch(cmd){
+		case CMD_EEPROM_READ:
+			return flash_sim_read(StartAddr, Buffer, Length);
+		case CMD_EEPROM_WRITE:
+			return flash_sim_write(StartAddr, Buffer, Length);
+		case CMD_EEPROM_ERASE:
+			return flash_sim_erase(StartAddr, Length);
+		default:
+			break;
+	}
+	return 1;
+}
+
+int flash_sim_init(uint32_t erase_size){
+	if (erase_size != EEPROM_MIN_ER_SIZE && erase_size != EEPROM_BLOCK_SIZE){
+		return -1;
+	}
+	sim.erase_size = erase_size;
+	memset(sim.mem, 0xff, sizeof(sim.mem));
+	memset(sim.wear, 0, sizeof(sim.wear));
+	memset(&sim.stat, 0, sizeof(sim.stat));
+	flash_sim_power_restore();
+	return 0;
+}
+
+void flash_sim_set_strict(int strict){
+	sim.strict = strict ? 1 : 0;
+}
+
+int flash_sim_load(const char *path){
+	FILE *fp = fopen(path, "rb");
+	size_t len = 0;
+	if (!fp){
+		return -1;
+	}
+	len = fread(sim.mem, 1, sizeof(sim.mem), fp);
+	fclose(fp);
+	return len == sizeof(sim.mem) ? 0 : -1;
+}
+
+int flash_sim_save(const char *path){
+	FILE *fp = fopen(path, "wb");
+	size_t len = 0;
+	if (!fp){
+		return -1;
+	}
+	len = fwrite(sim.mem, 1, sizeof(sim.mem), fp);
+	fclose(fp);
+	return len == sizeof(sim.mem) ? 0 : -1;
+}
+
+void flash_sim_power_cut(uint32_t bytes){
+	sim.power_cut = 1;
+	sim.power_lost = 0;
+	sim.power_bytes = bytes;
+}
+
+void flash_sim_power_restore(){
+	sim.power_cut = 0;
+	sim.power_lost = 0;
+}
+
+int flash_sim_power_lost(){
+	return sim.power_lost;
+}
+
+void flash_sim_snapshot(uint8_t *buf){
+	memcpy(buf, sim.mem, sizeof(sim.mem));
+}
+
+void flash_sim_rollback(const uint8_t *buf){
+	memcpy(sim.mem, buf, sizeof(sim.mem));
+}
+
+void flash_sim_stat_get(flash_sim_stat_t *stat){
+	memcpy(stat, &sim.stat, sizeof(flash_sim_stat_t));
+}
+
+void flash_sim_stat_reset(){
+	memset(&sim.stat, 0, sizeof(sim.stat));
+}
+
+const uint32_t *flash_sim_wear(uint32_t *cnt){
+	if (cnt){
+		*cnt = FLASH_SIM_UNIT_MAX;
+	}
+	return sim.wear;
+}
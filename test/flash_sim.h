@@ -0,0 +1,69 @@
+#ifndef __FLASH_SIM_H__
+#define __FLASH_SIM_H__
+
+#include <stdint.h>
+
+/**
+ * RAM-backed Data-Flash(EEPROM) simulator.
+ * - writes only program bits from 1 to 0, every 256 bytes page touched by a 
+ *   write is counted as one page program;
+ * - erases must be aligned to the erase unit and reset whole units to 0xFF;
+ * - reads, writes and erases outside EEPROM_MAX_SIZE are rejected.
+ */
+typedef struct flash_sim_stat{
+	uint32_t read_cnt;
+	uint32_t read_bytes;
+	uint32_t write_cnt;
+	uint32_t write_bytes;
+	uint32_t page_prog_cnt;
+	uint32_t erase_cnt;
+	uint32_t erase_bytes;
+	uint32_t violation_cnt;	//writes trying to program a bit from 0 to 1
+} flash_sim_stat_t;
+
+/**
+ * @brief reset the simulated Data-Flash to erased state
+ * @param erase_size erase unit in bytes, EEPROM_MIN_ER_SIZE(256) or 
+ * EEPROM_BLOCK_SIZE(4096)
+ * @return 0-success, (-1)-invalid erase size
+ */
+int flash_sim_init(uint32_t erase_size);
+
+/**
+ * @brief In strict mode(default) a write programming any bit from 0 to 1 
+ * fails. Otherwise the bits are silently ANDed as the real part does.
+ */
+void flash_sim_set_strict(int strict);
+
+int flash_sim_load(const char *path);
+int flash_sim_save(const char *path);
+
+/**
+ * @brief simulate a power loss after "bytes" more bytes are programmed. The 
+ * write reaching the limit is torn, and all following writes and erases fail 
+ * until flash_sim_power_restore is called.
+ */
+void flash_sim_power_cut(uint32_t bytes);
+void flash_sim_power_restore();
+/**
+ * @return 1 if the armed power loss has happened
+ */
+int flash_sim_power_lost();
+
+/**
+ * @brief copy the whole simulated flash(EEPROM_MAX_SIZE bytes) to "buf", or 
+ * back from it.
+ */
+void flash_sim_snapshot(uint8_t *buf);
+void flash_sim_rollback(const uint8_t *buf);
+
+void flash_sim_stat_get(flash_sim_stat_t *stat);
+void flash_sim_stat_reset();
+
+/**
+ * @brief erase counters of every erase unit
+ * @param cnt number of erase units
+ */
+const uint32_t *flash_sim_wear(uint32_t *cnt);
+
+#endif
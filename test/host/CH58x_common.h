@@ -0,0 +1,26 @@
+/*
+ * Host build replacement of the CH58x peripheral library umbrella header.
+ * Only what the storage/config modules need is provided, Data-Flash commands
+ * from "ISP583.h" are served by the simulator in flash_sim.c.
+ */
+#ifndef __CH58x_COMM_H__
+#define __CH58x_COMM_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define __HIGH_CODE
+#define __INTERRUPT
+
+extern int host_log_enable;
+#define PRINT(fmt, ...)	do{ \
+	if (host_log_enable){ \
+		printf(fmt, ##__VA_ARGS__); \
+	} \
+}while(0)
+
+#include "ISP583.h"
+
+#endif
@@ -0,0 +1,12 @@
+#include <time.h>
+#include "worktime.h"
+
+worktime_t worktime_get(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (worktime_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+worktime_t worktime_since(worktime_t from){
+	return worktime_get() - from;
+}
@@ -0,0 +1,168 @@
+/*
+ * MD5 benchmark.
+ * Checks src/utils/md5.c against the RFC 1321 test suite, then hashes random
+ * data aligned and unaligned, in one piece and in random split updates, and
+ * compares the digests. Reports the throughput of the aligned fast path and
+ * of the copying path. Exit status is non-zero if any check failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "utils/md5.h"
+
+#define BENCH_BUF_MAX	4096
+
+typedef struct bench_vector{
+	const char *msg;
+	const char *digest;
+} bench_vector_t;
+
+/* RFC 1321, A.5 Test suite */
+static const bench_vector_t vectors[] = {
+	{"", "d41d8cd98f00b204e9800998ecf8427e"},
+	{"a", "0cc175b9c0f1b6a831c399e269772661"},
+	{"abc", "900150983cd24fb0d6963f7d28e17f72"},
+	{"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+	{"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+	{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		"d174ab98d277d9f5a5611c2c9f419d9f"},
+	{"1234567890123456789012345678901234567890"
+		"1234567890123456789012345678901234567890",
+		"57edf4a22be3c955ac49da2e2107b67a"},
+};
+#define VECTOR_CNT	(sizeof(vectors) / sizeof(vectors[0]))
+
+static uint8_t buf[BENCH_BUF_MAX + 8] __attribute__((aligned(4)));
+static uint8_t shifted[BENCH_BUF_MAX + 8] __attribute__((aligned(4)));
+static int errors = 0;
+
+static uint64_t bench_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void md5_hex(const uint8_t *md5, char *hex){
+	int i = 0;
+	for (i = 0; i < 16; i++){
+		sprintf(hex + 2 * i, "%02x", md5[i]);
+	}
+}
+
+static void md5_oneshot(const uint8_t *data, unsigned len, uint8_t *md5){
+	MD5_CTX ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, data, len);
+	MD5Final(md5, &ctx);
+}
+
+static void bench_vectors(){
+	uint8_t md5[16];
+	char hex[33];
+	int i = 0;
+	for (i = 0; i < VECTOR_CNT; i++){
+		md5_oneshot((const uint8_t *)vectors[i].msg, strlen(vectors[i].msg), md5);
+		md5_hex(md5, hex);
+		if (strcmp(hex, vectors[i].digest)){
+			fprintf(stderr, "MD5(\"%s\") = %s, expect %s\n", vectors[i].msg,
+				hex, vectors[i].digest);
+			errors ++;
+		}
+	}
+}
+
+/**
+ * @brief digests of the same data must not depend on its alignment or on
+ * how it is split into updates
+ */
+static void bench_verify(int rounds){
+	MD5_CTX ctx;
+	uint8_t expect[16], md5[16];
+	uint32_t len = 0, split = 0, pos = 0, step = 0;
+	int shift = 0;
+	int i = 0;
+	for (i = 0; i < rounds; i++){
+		len = rand() % BENCH_BUF_MAX;
+		shift = rand() % 4;
+		md5_oneshot(buf, len, expect);
+		memcpy(shifted + shift, buf, len);
+		md5_oneshot(shifted + shift, len, md5);
+		if (memcmp(md5, expect, 16)){
+			fprintf(stderr, "len %u shift %d: digest mismatch\n", len, shift);
+			errors ++;
+			break;
+		}
+		MD5Init(&ctx);
+		for (pos = 0; pos < len; pos += step){
+			split = rand() % 3 ? rand() % 80 : rand() % 600;
+			step = split < len - pos ? split : len - pos;
+			MD5Update(&ctx, shifted + shift + pos, step);
+		}
+		MD5Final(md5, &ctx);
+		if (memcmp(md5, expect, 16)){
+			fprintf(stderr, "len %u shift %d: split digest mismatch\n",
+				len, shift);
+			errors ++;
+			break;
+		}
+	}
+}
+
+/**
+ * @return MB/s over blocks of "len" starting "shift" bytes past alignment
+ */
+static double bench_speed(uint32_t len, int shift){
+	uint8_t md5[16];
+	volatile uint8_t sink = 0;
+	uint32_t total = 0;
+	uint64_t ns = 0;
+	ns = bench_ns();
+	while (total < 64 * 1024 * 1024){
+		md5_oneshot(shifted + shift, len, md5);
+		sink ^= md5[0];
+		total += len;
+	}
+	ns = bench_ns() - ns;
+	return total * 1000.0 / ns;
+}
+
+static void usage(const char *name){
+	printf("usage: %s [-r rounds] [-s seed]\n", name);
+}
+
+int main(int argc, char **argv){
+	static const uint32_t speed_len[] = {64, 256, BENCH_BUF_MAX};
+	int rounds = 2000;
+	unsigned seed = 1;
+	int opt = 0;
+	int i = 0;
+	while ((opt = getopt(argc, argv, "r:s:h")) != -1){
+		switch(opt){
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	for (i = 0; i < sizeof(buf); i++){
+		buf[i] = rand();
+		shifted[i] = rand();
+	}
+	bench_vectors();
+	bench_verify(rounds);
+	printf("%6s %10s %10s\n", "len", "aligned", "unaligned");
+	for (i = 0; i < sizeof(speed_len) / sizeof(speed_len[0]); i++){
+		printf("%6u %10.1f %10.1f\n", speed_len[i], bench_speed(speed_len[i], 0),
+			bench_speed(speed_len[i], 1));
+	}
+	printf("MB/s, %s, %d errors\n", errors ? "FAIL" : "PASS", errors);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,670 @@
+/*
+ * Storage benchmark over the simulated Data-Flash.
+ * Runs write/read cycles through st_write_item/st_read_item, checks every 
+ * value read back against a shadow copy and reports flash operations and wall 
+ * time per storage operation. Exit status is non-zero if any check failed.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "CH58x_common.h"
+#include "storage.h"
+#include "configtool.h"
+#include "utils.h"
+#include "flash_sim.h"
+
+#define BENCH_KEY_BASE	0x100
+#define BENCH_KEY_MAX	64
+#define BENCH_BATCH_MAX	3
+#define BENCH_BATCH_LEN_MAX	60
+#define BENCH_COLD_BASE	0x400
+// erases the hot pages may take while a cold page is being compacted
+#define BENCH_WEAR_MARGIN	8
+
+typedef struct bench_item{
+	int len;
+	uint8_t data[ST_MAX_CONTENT_LEN];
+} bench_item_t;
+
+typedef struct bench_phase{
+	const char *name;
+	uint32_t ops;
+	uint64_t ns;
+	uint32_t write_max;	//most flash writes done by a single call
+	uint32_t erase_max;
+	flash_sim_stat_t stat;
+} bench_phase_t;
+
+static bench_item_t shadow[BENCH_KEY_MAX];
+static int key_cnt = 8;
+static int len_max = 32;
+static int errors = 0;
+static uint32_t wear_base[EEPROM_MAX_SIZE / EEPROM_MIN_ER_SIZE];
+static bench_phase_t *phase_cur = NULL;
+static flash_sim_stat_t op_stat;
+
+static uint64_t bench_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_begin(bench_phase_t *phase, const char *name){
+	memset(phase, 0, sizeof(bench_phase_t));
+	phase->name = name;
+	phase_cur = phase;
+	flash_sim_stat_reset();
+	phase->ns = bench_ns();
+}
+
+static void bench_end(bench_phase_t *phase, uint32_t ops){
+	phase->ns = bench_ns() - phase->ns;
+	phase->ops = ops ? ops : 1;
+	flash_sim_stat_get(&phase->stat);
+}
+
+static void bench_report(bench_phase_t *phase){
+	double ops = phase->ops;
+	printf("%-8s %8u %9.2f %9.2f %9.2f %9.3f %10.1f %10.2f %6u %6u\n", 
+		phase->name, phase->ops, phase->stat.read_cnt / ops, 
+		phase->stat.write_cnt / ops, phase->stat.page_prog_cnt / ops, 
+		phase->stat.erase_cnt / ops, phase->stat.read_bytes / ops, 
+		phase->ns / ops / 1000.0, phase->write_max, phase->erase_max);
+}
+
+/**
+ * bench_op_begin/bench_op_end bracket a single storage call, the most flash 
+ * writes and erases it took are kept in the current phase.
+ */
+static void bench_op_begin(){
+	flash_sim_stat_get(&op_stat);
+}
+
+static void bench_op_end(){
+	flash_sim_stat_t stat;
+	flash_sim_stat_get(&stat);
+	phase_cur->write_max = MAX(phase_cur->write_max, 
+		stat.write_cnt - op_stat.write_cnt);
+	phase_cur->erase_max = MAX(phase_cur->erase_max, 
+		stat.erase_cnt - op_stat.erase_cnt);
+}
+
+static void bench_fill(bench_item_t *item, int len_limit){
+	int i = 0;
+	item->len = 1 + rand() % MIN(len_max, len_limit);
+	for (i = 0; i < item->len; i++){
+		item->data[i] = rand();
+	}
+}
+
+static int bench_check(int key){
+	uint8_t buf[ST_MAX_CONTENT_LEN];
+	bench_item_t *item = &shadow[key];
+	int ret = st_read_item(BENCH_KEY_BASE + key, buf, sizeof(buf));
+	if (ret != item->len || (ret > 0 && memcmp(buf, item->data, ret))){
+		fprintf(stderr, "key %04X: read %d bytes, expect %d\n", 
+			BENCH_KEY_BASE + key, ret, item->len);
+		errors ++;
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_write(int key){
+	bench_item_t *item = &shadow[key];
+	int ret = 0;
+	bench_fill(item, len_max);
+	bench_op_begin();
+	ret = st_write_item(BENCH_KEY_BASE + key, item->data, item->len);
+	bench_op_end();
+	if (ret < 0){
+		fprintf(stderr, "key %04X: write failed\n", BENCH_KEY_BASE + key);
+		errors ++;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Write the keys in the old layout(1 byte page header) over all pages, so 
+ * that no page is erased and the first one is migrated in place. Every key 
+ * also leaves a deleted record in the next page.
+ */
+static void bench_old_write(){
+	crc_type_t crc8 = CRC8_MAXIM_INIT;
+	uint8_t record[sizeof(st_item_header_t) + ST_MAX_CONTENT_LEN];
+	st_item_header_t *header = (st_item_header_t *)record;
+	uint16_t used[ST_PAGE_MAX];
+	bench_item_t stale;
+	bench_item_t *item = NULL;
+	uint8_t status = 0;
+	int i = 0, j = 0, page = 0, size = 0;
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		used[i] = ST_OLD_HEADER_SIZE;
+	}
+	for (i = 0; i < key_cnt; i++){
+		bench_fill(&stale, len_max);
+		bench_fill(&shadow[i], len_max);
+		for (j = 0; j < 2; j++){
+			item = j ? &stale : &shadow[i];
+			page = (i + j) % ST_PAGE_MAX;
+			header->len = item->len;
+			header->crc = crc_check(&crc8, item->data, item->len);
+			header->idx = j ? 0 : BENCH_KEY_BASE + i;
+			memcpy(record + sizeof(st_item_header_t), item->data, item->len);
+			size = sizeof(st_item_header_t) + item->len;
+			if (used[page] + size > ST_PAGE_SIZE){
+				fprintf(stderr, "old layout: page %d is full\n", page);
+				errors ++;
+				return;
+			}
+			EEPROM_WRITE(page * ST_PAGE_SIZE + used[page], record, size);
+			used[page] += size;
+		}
+	}
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		status = i ? ST_PAGE_S_OLD_FULL : ST_PAGE_S_OLD_ACTIVE;
+		EEPROM_WRITE(i * ST_PAGE_SIZE, &status, 1);
+	}
+}
+
+static void bench_old_check(){
+	uint8_t status = 0;
+	int i = 0;
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		EEPROM_READ(i * ST_PAGE_SIZE, &status, 1);
+		if (ST_PAGE_S_OLD_ACTIVE == status || ST_PAGE_S_OLD_FULL == status){
+			fprintf(stderr, "page %d: still in the old layout\n", i);
+			errors ++;
+		}
+	}
+}
+
+/**
+ * Save the address and UART config the way builds before the cfg_items index 
+ * fix did, each under the key of the next item and zero padded to its size.
+ */
+static void bench_cfg_old_write(uint8_t addr, cfg_uart_t *uart){
+	uint8_t buf[sizeof(cfg_ota_t)];
+	memset(buf, 0, sizeof(buf));
+	buf[0] = addr;
+	st_write_item(CFG_KEY_MB_UART, buf, sizeof(cfg_uart_t));
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, uart, sizeof(cfg_uart_t));
+	st_write_item(CFG_KEY_OTA, buf, sizeof(cfg_ota_t));
+}
+
+static void bench_cfg_old_check(uint8_t addr, cfg_uart_t *uart){
+	cfg_uart_t uart_read;
+	cfg_ota_t ota_read;
+	cfg_ota_t ota_zero = {0};
+	uint8_t addr_read = 0;
+	cfg_get_mb_addr(&addr_read);
+	cfg_get_mb_uart(&uart_read);
+	cfg_get_ota(&ota_read);
+	if (addr_read != addr || memcmp(&uart_read, uart, sizeof(cfg_uart_t)) || 
+		memcmp(&ota_read, &ota_zero, sizeof(cfg_ota_t)))
+	{
+		fprintf(stderr, "cfg: old records not migrated\n");
+		errors ++;
+	}
+	memset(&uart_read, 0, sizeof(uart_read));
+	st_read_item(CFG_KEY_MB_UART, (uint8_t *)&uart_read, sizeof(uart_read));
+	if (memcmp(&uart_read, uart, sizeof(cfg_uart_t))){
+		fprintf(stderr, "cfg: uart not saved under %04X\n", CFG_KEY_MB_UART);
+		errors ++;
+	}
+}
+
+static int bench_match(int key, bench_item_t *item){
+	uint8_t buf[ST_MAX_CONTENT_LEN];
+	int ret = st_read_item(BENCH_KEY_BASE + key, buf, sizeof(buf));
+	return ret == item->len && (ret <= 0 || !memcmp(buf, item->data, ret));
+}
+
+/**
+ * Cut the power at every byte of a batch write in turn, always starting from 
+ * the same flash image. After reboot the keys of the batch must hold either 
+ * all old or all new values, other keys must not change.
+ * @return number of power cuts
+ */
+static uint32_t bench_powercut(int rounds){
+	static uint8_t image[EEPROM_MAX_SIZE];
+	bench_item_t next[BENCH_BATCH_MAX];
+	st_batch_item_t items[BENCH_BATCH_MAX];
+	int cnt = MIN(key_cnt, BENCH_BATCH_MAX);
+	int old_cnt = 0, new_cnt = 0;
+	uint32_t total = 0;
+	uint32_t cut = 0;
+	int lost = 0;
+	int ret = 0;
+	int i = 0;
+	while (rounds --){
+		for (i = 0; i < cnt; i++){
+			bench_fill(&next[i], BENCH_BATCH_LEN_MAX);
+			items[i].item_idx = BENCH_KEY_BASE + i;
+			items[i].buf = next[i].data;
+			items[i].len = next[i].len;
+		}
+		flash_sim_snapshot(image);
+		for (cut = 0; ; cut++){
+			flash_sim_rollback(image);
+			st_init();
+			flash_sim_power_cut(cut);
+			ret = st_write_batch(items, cnt);
+			lost = flash_sim_power_lost();
+			flash_sim_power_restore();
+			st_init();
+			total ++;
+			old_cnt = new_cnt = 0;
+			for (i = 0; i < cnt; i++){
+				old_cnt += bench_match(i, &shadow[i]);
+				new_cnt += bench_match(i, &next[i]);
+			}
+			if (!lost && (ret < 0 || new_cnt != cnt)){
+				fprintf(stderr, "batch write failed\n");
+				errors ++;
+				return total;
+			}
+			if (new_cnt != cnt && old_cnt != cnt){
+				fprintf(stderr, "cut at %u: batch partially applied(%d old, %d new)\n", 
+					cut, old_cnt, new_cnt);
+				errors ++;
+				return total;
+			}
+			for (i = cnt; i < key_cnt; i++){
+				bench_check(i);
+			}
+			if (!lost){
+				break;
+			}
+		}
+		memcpy(shadow, next, cnt * sizeof(bench_item_t));
+	}
+	return total;
+}
+
+static void bench_cold_fill(int key, bench_item_t *item){
+	int i = 0;
+	item->len = ST_MAX_CONTENT_LEN - sizeof(st_item_header_t);
+	for (i = 0; i < item->len; i++){
+		item->data[i] = key * 7 + i;
+	}
+}
+
+/**
+ * Fill the log with "cnt" cold items of one page each, so that only a few 
+ * pages are left for the keys being written and compaction has to run.
+ */
+static void bench_cold_write(int cnt){
+	bench_item_t item;
+	int i = 0;
+	for (i = 0; i < cnt; i++){
+		bench_cold_fill(i, &item);
+		if (st_write_item(BENCH_COLD_BASE + i, item.data, item.len) < 0){
+			fprintf(stderr, "cold key %04X: write failed\n", BENCH_COLD_BASE + i);
+			errors ++;
+		}
+	}
+}
+
+static void bench_cold_check(int cnt){
+	bench_item_t item;
+	int i = 0;
+	for (i = 0; i < cnt; i++){
+		bench_cold_fill(i, &item);
+		if (!bench_match(BENCH_COLD_BASE + i - BENCH_KEY_BASE, &item)){
+			fprintf(stderr, "cold key %04X: mismatch\n", BENCH_COLD_BASE + i);
+			errors ++;
+		}
+	}
+}
+
+/**
+ * Print erase count statistics of the storage pages, counted from the last 
+ * bench_wear_mark call.
+ * @return max erase count
+ */
+static uint32_t bench_wear_report(const char *name){
+	uint32_t cnt = 0;
+	uint32_t i = 0;
+	uint32_t min = 0xffffffff, max = 0;
+	double avg = 0, var = 0;
+	const uint32_t *wear = flash_sim_wear(&cnt);
+	cnt = MIN(cnt, ST_PAGE_MAX * ST_PAGE_SIZE / EEPROM_MIN_ER_SIZE);
+	for (i = 0; i < cnt; i++){
+		min = MIN(min, wear[i] - wear_base[i]);
+		max = MAX(max, wear[i] - wear_base[i]);
+		avg += wear[i] - wear_base[i];
+	}
+	avg = cnt ? avg / cnt : 0;
+	for (i = 0; i < cnt; i++){
+		var += (wear[i] - wear_base[i] - avg) * (wear[i] - wear_base[i] - avg);
+	}
+	printf("%s: %u units, erase min %u, max %u, avg %.1f, stddev %.2f\n", 
+		name, cnt, min, max, avg, cnt ? sqrt(var / cnt) : 0.0);
+	return max;
+}
+
+/**
+ * Check the erase counters in the page headers: every page must be in the 
+ * new layout and no counter may exceed the erases the simulator counted on 
+ * the most worn page, which bounds the estimate of a lost counter as well.
+ * @return spread(max - min) of the counters
+ */
+static uint32_t bench_erase_cnt_check(const char *name){
+	st_page_header_t header;
+	uint32_t cnt = 0;
+	uint32_t i = 0;
+	uint32_t erase_cnt = 0;
+	uint32_t wear_max = 0;
+	uint32_t min = ST_ERASE_CNT_UNKNOWN, max = 0;
+	const uint32_t *wear = flash_sim_wear(&cnt);
+	cnt = MIN(cnt, ST_PAGE_MAX * ST_PAGE_SIZE / EEPROM_MIN_ER_SIZE);
+	for (i = 0; i < cnt; i++){
+		wear_max = MAX(wear_max, wear[i]);
+	}
+	for (i = 0; i < ST_PAGE_MAX; i++){
+		EEPROM_READ(i * ST_PAGE_SIZE, &header, sizeof(header));
+		erase_cnt = header.erase_cnt[0] | (header.erase_cnt[1] << 8) | 
+			((uint32_t)header.erase_cnt[2] << 16);
+		if (ST_PAGE_S_ERASED != header.status && 
+			ST_PAGE_S_ACTIVE != header.status && 
+			ST_PAGE_S_FULL != header.status)
+		{
+			fprintf(stderr, "%s: page %u in status %02X\n", name, i, 
+				header.status);
+			errors ++;
+			continue;
+		}
+		if (ST_ERASE_CNT_UNKNOWN == erase_cnt){
+			continue;
+		}
+		if (erase_cnt > wear_max){
+			fprintf(stderr, "%s: page %u counts %u erases, at most %u done\n", 
+				name, i, erase_cnt, wear_max);
+			errors ++;
+		}
+		min = MIN(min, erase_cnt);
+		max = MAX(max, erase_cnt);
+	}
+	return max >= min ? max - min : 0;
+}
+
+static void bench_wear_mark(){
+	uint32_t cnt = 0;
+	const uint32_t *wear = flash_sim_wear(&cnt);
+	memcpy(wear_base, wear, MIN(cnt, ARRAY_SIZE(wear_base)) * sizeof(uint32_t));
+}
+
+/**
+ * Skewed workload: every key is written once and stays cold, then all writes 
+ * go to key 0. Reports how evenly the erases were spread and how many such 
+ * writes the log takes before its most worn page reaches "rated" cycles, 
+ * fails if the erase counters drift further apart than ST_WEAR_DELTA_MAX.
+ */
+static void bench_endurance(uint32_t ops, uint32_t rated){
+	bench_phase_t phase;
+	uint32_t i = 0;
+	uint32_t max = 0;
+	uint32_t spread = 0;
+	for (i = 0; i < key_cnt; i++){
+		bench_write(i);
+	}
+	bench_wear_mark();
+	bench_begin(&phase, "endure");
+	for (i = 0; i < ops; i++){
+		bench_write(0);
+	}
+	bench_end(&phase, ops);
+	bench_report(&phase);
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+	max = bench_wear_report("endure wear");
+	spread = bench_erase_cnt_check("endure");
+	printf("endure: erase counters spread %u\n", spread);
+	if (spread > ST_WEAR_DELTA_MAX + BENCH_WEAR_MARGIN){
+		fprintf(stderr, "endure: erase counters spread %u, limit %u\n", 
+			spread, ST_WEAR_DELTA_MAX);
+		errors ++;
+	}
+	if (max){
+		printf("endure: %.0f hot writes until a page reaches %u cycles\n", 
+			(double)ops * rated / max, rated);
+	}
+}
+
+static void usage(const char *name){
+	printf("usage: %s [-n cycles] [-k keys] [-l max_len] [-s seed] "
+		"[-e erase_size] [-E endure_ops] [-c rated_cycles] [-v]\n", name);
+}
+
+int main(int argc, char **argv){
+	bench_phase_t phase;
+	cfg_ota_t ota = {0};
+	cfg_uart_t uart_old = {.baudrate = 115200, .databits = 8, 
+		.parity = CFG_UART_PAR_EVEN, .stopbits = CFG_UART_SB_1};
+	uint32_t cycles = 5000;
+	uint32_t erase_size = EEPROM_MIN_ER_SIZE;
+	uint32_t endure = 0;
+	uint32_t rated = 100000;
+	uint32_t i = 0;
+	int opt = 0;
+	int ret = 0;
+	unsigned seed = 1;
+	while ((opt = getopt(argc, argv, "n:k:l:s:e:E:c:vh")) != -1){
+		switch(opt){
+			case 'n':
+				cycles = strtoul(optarg, NULL, 0);
+				break;
+			case 'k':
+				key_cnt = atoi(optarg);
+				break;
+			case 'l':
+				len_max = atoi(optarg);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'e':
+				erase_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'E':
+				endure = strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				rated = strtoul(optarg, NULL, 0);
+				break;
+			case 'v':
+				host_log_enable = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if (key_cnt <= 0 || key_cnt > BENCH_KEY_MAX || 
+		len_max <= 0 || len_max > ST_MAX_CONTENT_LEN)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+	if (flash_sim_init(erase_size) < 0){
+		fprintf(stderr, "invalid erase size %u\n", erase_size);
+		return 2;
+	}
+	srand(seed);
+	memset(shadow, 0, sizeof(shadow));
+	printf("cycles:%u keys:%d max_len:%d erase:%u pages:%d\n", cycles, key_cnt, 
+		len_max, erase_size, ST_PAGE_MAX);
+	printf("%-8s %8s %9s %9s %9s %9s %10s %10s %6s %6s\n", "phase", "ops", 
+		"rd/op", "wr/op", "prog/op", "erase/op", "rdB/op", "us/op", "wr/max", 
+		"er/max");
+
+	// the log starts from pages in the old layout
+	bench_old_write();
+	bench_begin(&phase, "migrate");
+	st_init();
+	bench_end(&phase, 1);
+	bench_report(&phase);
+	bench_old_check();
+	bench_erase_cnt_check("migrate");
+	st_init();
+	bench_old_check();
+
+	bench_begin(&phase, "write");
+	for (i = 0; i < cycles; i++){
+		bench_write(rand() % key_cnt);
+	}
+	bench_end(&phase, cycles);
+	bench_report(&phase);
+
+	bench_begin(&phase, "read");
+	for (i = 0; i < cycles; i++){
+		bench_check(rand() % key_cnt);
+	}
+	bench_end(&phase, cycles);
+	bench_report(&phase);
+
+	bench_begin(&phase, "mixed");
+	for (i = 0; i < cycles; i++){
+		if (rand() % 4){
+			bench_check(rand() % key_cnt);
+		}else{
+			bench_write(rand() % key_cnt);
+		}
+	}
+	bench_end(&phase, cycles);
+	bench_report(&phase);
+
+	bench_begin(&phase, "reboot");
+	st_init();
+	bench_end(&phase, 1);
+	bench_report(&phase);
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+
+	// config records left by older builds are moved on the first cfg_init
+	bench_cfg_old_write(17, &uart_old);
+	st_init();
+	cfg_init();
+	bench_cfg_old_check(17, &uart_old);
+
+	bench_begin(&phase, "cfg");
+	for (i = 0; i < cycles / 10; i++){
+		ota.app_version = i;
+		ota.ota_version = i + 1;
+		bench_op_begin();
+		if (cfg_update_ota(&ota) < 0){
+			errors ++;
+		}
+		bench_op_end();
+	}
+	bench_end(&phase, cycles / 10);
+	bench_report(&phase);
+	st_init();
+	memset(&ota, 0xff, sizeof(ota));
+	st_read_item(CFG_KEY_OTA, (uint8_t *)&ota, sizeof(ota));
+	if (cycles / 10 && ota.app_version != cycles / 10 - 1){
+		fprintf(stderr, "cfg ota mismatch\n");
+		errors ++;
+	}
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+
+	bench_begin(&phase, "cfg-all");
+	for (i = 0; i < cycles / 10; i++){
+		cfg_uart_t uart = {.baudrate = 9600 + i, .databits = 8};
+		uint8_t addr = 1 + i % 247;
+		ota.app_version = i;
+		bench_op_begin();
+		if (cfg_update(&addr, &uart, &ota, NULL, NULL) < 0){
+			errors ++;
+		}
+		bench_op_end();
+	}
+	bench_end(&phase, cycles / 10);
+	bench_report(&phase);
+
+	bench_begin(&phase, "batch");
+	for (i = 0; i < cycles / 10; i++){
+		st_batch_item_t items[BENCH_BATCH_MAX];
+		bench_item_t next[BENCH_BATCH_MAX];
+		int j = 0, cnt = MIN(key_cnt, BENCH_BATCH_MAX);
+		for (j = 0; j < cnt; j++){
+			bench_fill(&next[j], BENCH_BATCH_LEN_MAX);
+			items[j].item_idx = BENCH_KEY_BASE + j;
+			items[j].buf = next[j].data;
+			items[j].len = next[j].len;
+		}
+		bench_op_begin();
+		ret = st_write_batch(items, cnt);
+		bench_op_end();
+		if (ret < 0){
+			fprintf(stderr, "batch write failed\n");
+			errors ++;
+			continue;
+		}
+		memcpy(shadow, next, cnt * sizeof(bench_item_t));
+	}
+	bench_end(&phase, cycles / 10);
+	bench_report(&phase);
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+
+	bench_begin(&phase, "powercut");
+	i = bench_powercut(16);
+	bench_end(&phase, i);
+	bench_report(&phase);
+
+	// nearly full log: compaction runs in the writes, or in st_poll between 
+	// them as the main loop does when idle
+	bench_cold_write(ST_PAGE_MAX - 2 * ST_GC_PAGE_LOW);
+	bench_begin(&phase, "full");
+	for (i = 0; i < cycles; i++){
+		bench_write(rand() % key_cnt);
+	}
+	bench_end(&phase, cycles);
+	bench_report(&phase);
+
+	bench_begin(&phase, "poll");
+	for (i = 0; i < cycles; i++){
+		bench_write(rand() % key_cnt);
+		while ((ret = st_poll()) > 0);
+		if (ret < 0){
+			fprintf(stderr, "poll failed\n");
+			errors ++;
+		}
+	}
+	bench_end(&phase, cycles);
+	bench_report(&phase);
+	st_init();
+	for (i = 0; i < key_cnt; i++){
+		bench_check(i);
+	}
+	bench_cold_check(ST_PAGE_MAX - 2 * ST_GC_PAGE_LOW);
+
+	// power cuts now also hit compaction steps
+	bench_begin(&phase, "cut-full");
+	i = bench_powercut(8);
+	bench_end(&phase, i);
+	bench_report(&phase);
+	bench_cold_check(ST_PAGE_MAX - 2 * ST_GC_PAGE_LOW);
+
+	bench_wear_report("wear");
+	if (endure){
+		bench_endurance(endure, rated);
+	}
+	printf("%s, %d errors\n", errors ? "FAIL" : "PASS", errors);
+	return errors ? 1 : 0;
+}